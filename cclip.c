@@ -16,10 +16,6 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-// TODO fix indexing into wchar_t strings to account for Unicode surrogates
-//      --> investigate every spot that does something with sizeof(wchar_t)
-//      --> http://msdn.microsoft.com/en-us/library/dd374069.aspx
-
 #ifdef _MSC_VER
 #define _CRT_SECURE_NO_WARNINGS
 #define snprintf _snprintf
@@ -29,36 +25,7 @@
 #include <stdio.h>
 #include <string.h>
 
-typedef struct ErrBlock_
-{
-    unsigned int functionSpecificErrorCode;
-    char errDescription[256];
-} ErrBlock;
-
-typedef enum TagType_
-{
-    TagTypePreWithAttributes,
-    TagTypeUnderscore,
-    TagTypeFgBlue,
-    TagTypeFgGreen,
-    TagTypeFgRed,
-    TagTypeBgBlue,
-    TagTypeBgGreen,
-    TagTypeBgRed
-    // TODO extend TagType enum values
-} TagType;
-
-typedef struct FormatInfo_
-{
-    unsigned int numberOfTags;
-    struct
-    {
-        unsigned int characterPos;
-        TagType type;
-        unsigned int parameter;
-        unsigned int yClose;
-    } tags[1];
-} FormatInfo;
+#include "libcclip.h"
 
 void ShowUsage(char *pArgv0)
 {
@@ -71,8 +38,50 @@ typedef struct CmdLineOptions_
     unsigned int codepage;
     unsigned int yInputBufferSizeStepOverride;
     unsigned int inputBufferSizeStep;
+    const char **ppInputFileNames;
+    unsigned int numberOfInputFiles;
+    HighlightLanguage highlightLanguage;
+    unsigned int yOutputClipboard;
+    unsigned int yOutputHtml;
+    unsigned int yClipboardTimeoutOverride;
+    unsigned int clipboardTimeoutMs;
+    unsigned int yStats;
+    unsigned int yCrlf;
+    unsigned int yRecall;
+    unsigned int recallEntryNumber;
+    unsigned int yHistory;
+    unsigned int yLineSelection;
+    LineSelection lineSelection;
+    unsigned int yLineFilter;
+    LineFilter lineFilter;
+    unsigned int yEmitText;
+    unsigned int yEmitHtml;
+    const char *pEmitBaseName;
+    unsigned int yPreBlockSizeOverride;
+    unsigned int preBlockSizeBytes;
 } CmdLineOptions;
 
+/* OpenEmitFile()
+ *
+ * Open the output file for the -emit switch, named after a base name and an
+ * extension (created or truncated), or the standard output when the base
+ * name is NULL.
+ *
+ * Returns the file handle or INVALID_HANDLE_VALUE in case of an error.
+ */
+HANDLE OpenEmitFile(const char *pBaseName, const char *pExtension)
+{
+    char fileName[MAX_PATH];
+
+    if (pBaseName == NULL)
+        return GetStdHandle(STD_OUTPUT_HANDLE);
+
+    snprintf(fileName, sizeof(fileName), "%s%s", pBaseName, pExtension);
+    fileName[sizeof(fileName) - 1] = '\0';
+    return CreateFile(fileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
 void ParseCommandLineOptions(int argc, const char *argv[],
                              CmdLineOptions *pOptions)
 {
@@ -113,911 +122,309 @@ void ParseCommandLineOptions(int argc, const char *argv[],
                 }
             }
         }
-        else
+        else if (strncmp(argv[i], "-hl", 4) == 0 ||
+                 strncmp(argv[i], "-highlight", 11) == 0)
         {
-            // TODO handle unsupported command line switches
+            if (argc > i+1)
+            {
+                i++;
+                if (strcmp(argv[i], "diff") == 0)
+                    pOptions->highlightLanguage = HighlightLanguageDiff;
+                else if (strcmp(argv[i], "c") == 0 ||
+                         strcmp(argv[i], "cpp") == 0)
+                    pOptions->highlightLanguage = HighlightLanguageC;
+                else if (strcmp(argv[i], "log") == 0)
+                    pOptions->highlightLanguage = HighlightLanguageLog;
+            }
         }
-    }
-}
-
-/* ReadFileToNewBuffer()
- *
- * Allocate a buffer and fill it with data from a given file handle. Stores
- * the address of the allocated buffer (which must be released by the caller)
- * and the number of read bytes in output variables. The size of the allocated
- * buffer is not returned but will be the next multiple of bufferSizeStep
- * greater than or equal to the returned number of read bytes.
- *
- * Returns zero on success or -1 in case of an error. In case of an error
- * and when the error block pointer is not NULL the error block is filled with
- * an error description. When an error occurrs no buffer must be released by
- * the caller and the values of the output pointers are undefined.
- */
-int ReadFileToNewBuffer(HANDLE fileHandle, unsigned int bufferSizeStep,
-                     void **ppAllocatedBuffer, unsigned int *pReadBytes,
-                     ErrBlock *pEb)
-{
-    char *pInputBuffer = NULL;
-    unsigned int inputBufferSize = 0;
-    unsigned int yEndOfInput = 0;
-    unsigned int totalReadBytes = 0;
-
-    while (!yEndOfInput)
-    {
-        unsigned int bufferRemainingBytes;
-        char *pReadPointer;
-
-        pInputBuffer = realloc(pInputBuffer, inputBufferSize + bufferSizeStep);
-        pReadPointer = pInputBuffer + inputBufferSize;
-        inputBufferSize += bufferSizeStep;
-        bufferRemainingBytes = bufferSizeStep;
-        if (pInputBuffer == NULL)
+        else if (strncmp(argv[i], "-o", 3) == 0)
+        {
+            pOptions->yOutputClipboard = 1;
+        }
+        else if (strncmp(argv[i], "-format", 8) == 0)
         {
-            if (pEb != NULL)
+            if (argc > i+1)
             {
-                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                    "Could not allocate memory for input buffer");
-                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-                pEb->functionSpecificErrorCode = 1;
+                i++;
+                if (strcmp(argv[i], "html") == 0)
+                    pOptions->yOutputHtml = 1;
+                else if (strcmp(argv[i], "text") == 0)
+                    pOptions->yOutputHtml = 0;
             }
-            return -1;
         }
-
-        do
+        else if (strncmp(argv[i], "-timeout", 9) == 0)
         {
-            unsigned int readBytes;
-            if (!ReadFile(fileHandle, pReadPointer, bufferRemainingBytes,
-                &readBytes, NULL))
+            if (argc > i+1)
             {
-                unsigned int err = GetLastError();
-                if (err == ERROR_BROKEN_PIPE)
-                {
-                    yEndOfInput = 1;
-                    break;
-                }
-                else
+                int val;
+                i++;
+                val = strtol(argv[i], NULL, 0);
+                if (val >= 0)
                 {
-                    free(pInputBuffer);
-                    if (pEb != NULL)
-                    {
-                        // TODO multiple ErrBlock types + function for output
-                        //  - description in errDescription[]
-                        //  - GetLastError() number stored, later printed via FormatMessageW()
-                        //  - more?
-                        snprintf(pEb->errDescription,
-                            sizeof(pEb->errDescription),
-                            "ReadFile() failed, GetLastError() = 0x%X",
-                            GetLastError());
-                        pEb->errDescription[
-                            sizeof(pEb->errDescription) - 1] = '\0';
-                        pEb->functionSpecificErrorCode = 2;
-                    }
-                    return -1;
+                    pOptions->clipboardTimeoutMs = (unsigned int)val;
+                    pOptions->yClipboardTimeoutOverride = 1;
                 }
             }
-
-            pReadPointer += readBytes;
-            bufferRemainingBytes -= readBytes;
-
-            if (readBytes == 0)
-            {
-                yEndOfInput = 1;
-                break;
-            }
-        } while (bufferRemainingBytes != 0);
-
-        totalReadBytes += (bufferSizeStep - bufferRemainingBytes);
-    }
-
-    /* success */
-    *ppAllocatedBuffer = pInputBuffer;
-    *pReadBytes = totalReadBytes;
-    return 0;
-}
-
-/* ConvToZeroTerminatedWideCharNewBuffer()
- *
- * Convert a given string (not zero terminated) in a given codepage to a wide
- * character string and store it in an allocated buffer, adding a zero
- * termination character. Stores the address of the allocated buffer (which
- * must be released by the caller) and the size of the allocated buffer in
- * output variables.
- *
- * Returns zero on success or -1 in case of an error. In case of an error
- * and when the error block pointer is not NULL the error block is filled with
- * an error description. When an error occurrs no buffer must be released by
- * the caller and the values of the output pointers are undefined.
- */
-int ConvToZeroTerminatedWideCharNewBuffer(const char *pInputBuffer,
-                                          unsigned int numberOfInputBytes,
-                                          unsigned int codepage,
-                                          wchar_t **ppAllocatedWideCharBuffer,
-                                          unsigned int *pAllocatedBufSizeBytes,
-                                          ErrBlock *pEb)
-{
-    int retval;
-    int numberOfWideCharacters;
-    wchar_t *pWideCharBuf;
-
-    if (numberOfInputBytes != 0)
-    {
-        numberOfWideCharacters = MultiByteToWideChar(codepage, 0, pInputBuffer,
-            numberOfInputBytes, NULL, 0);
-        if (numberOfWideCharacters == 0)
+        }
+        else if (strncmp(argv[i], "-stats", 7) == 0)
         {
-            if (pEb != NULL)
-            {
-                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                    "MultiByteToWideChar() space detection failed, "
-                    "GetLastError() = 0x%X", GetLastError());
-                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-                pEb->functionSpecificErrorCode = 1;
-            }
-            return -1;
+            pOptions->yStats = 1;
         }
-    }
-    else
-    {
-        numberOfWideCharacters = 0;
-    }
-
-    pWideCharBuf = malloc((numberOfWideCharacters + 1) * sizeof(wchar_t));
-    if (pWideCharBuf == NULL)
-    {
-        if (pEb != NULL)
+        else if (strncmp(argv[i], "-crlf", 6) == 0)
         {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "Could not allocate conversion buffer");
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 2;
+            pOptions->yCrlf = 1;
         }
-        return -1;
-    }
-
-    if (numberOfInputBytes != 0)
-    {
-        retval = MultiByteToWideChar(codepage, 0, pInputBuffer,
-            numberOfInputBytes, pWideCharBuf, numberOfWideCharacters);
-        if (retval == 0)
+        else if (strncmp(argv[i], "-recall", 8) == 0)
         {
-            if (pEb != NULL)
+            if (argc > i+1)
             {
-                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                    "MultiByteToWideChar() conversion failed, GetLastError() "
-                    "= 0x%X", GetLastError());
-                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-                pEb->functionSpecificErrorCode = 3;
+                int val;
+                i++;
+                val = strtol(argv[i], NULL, 0);
+                if (val > 0)
+                {
+                    pOptions->recallEntryNumber = (unsigned int)val;
+                    pOptions->yRecall = 1;
+                }
             }
-            free(pWideCharBuf);
-            return -1;
         }
-    }
-    pWideCharBuf[numberOfWideCharacters] = L'\0';
-
-    /* success */
-    *ppAllocatedWideCharBuffer = pWideCharBuf;
-    *pAllocatedBufSizeBytes = (numberOfWideCharacters + 1) * sizeof(wchar_t);
-    return 0;
-}
-
-// TODO documentation for WriteToClipboard()
-int WriteToClipboard(unsigned int format, const void *pData,
-                     unsigned int sizeBytes, ErrBlock *pEb)
-{
-    HGLOBAL hGlobalMem;
-    unsigned char *pGlobalMem;
-
-    if (!OpenClipboard(0))
-    {
-        if (pEb != NULL)
+        else if (strncmp(argv[i], "-lines", 7) == 0)
         {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "OpenClipboard() failed, GetLastError() = 0x%X",
-                GetLastError());
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 1;
-        }
-        return -1;
-    }
-
-    if (!EmptyClipboard())
-    {
-        if (pEb != NULL)
-        {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "EmptyClipboard() failed, GetLastError() = 0x%X",
-                GetLastError());
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 2;
+            if (argc > i+1)
+            {
+                /* A:B, A: or :B, and A alone for a single line */
+                char *pEnd;
+                long first;
+                long last;
+                i++;
+                first = strtol(argv[i], &pEnd, 10);
+                last = first;
+                if (*pEnd == ':')
+                    last = strtol(pEnd + 1, NULL, 10);
+                if (first <= 0)
+                    first = 1;
+                if (last >= 0 && (last == 0 || last >= first))
+                {
+                    pOptions->lineSelection.yTail = 0;
+                    pOptions->lineSelection.firstLine = (unsigned int)first;
+                    pOptions->lineSelection.lastLine = (unsigned int)last;
+                    pOptions->yLineSelection = 1;
+                }
+            }
         }
-        CloseClipboard();
-        return -1;
-    }
-
-    hGlobalMem = GlobalAlloc(GMEM_MOVEABLE, sizeBytes);
-    if (hGlobalMem == NULL)
-    {
-        if (pEb != NULL)
+        else if (strncmp(argv[i], "-tail", 6) == 0)
         {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "GlobalAlloc() failed, GetLastError() = 0x%X",
-                GetLastError());
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 3;
+            if (argc > i+1)
+            {
+                int val;
+                i++;
+                val = strtol(argv[i], NULL, 0);
+                if (val > 0)
+                {
+                    pOptions->lineSelection.yTail = 1;
+                    pOptions->lineSelection.numberOfTailLines =
+                        (unsigned int)val;
+                    pOptions->yLineSelection = 1;
+                }
+            }
         }
-        CloseClipboard();
-        return -1;
-    }
-
-    pGlobalMem = GlobalLock(hGlobalMem);
-    if (pGlobalMem == NULL)
-    {
-        if (pEb != NULL)
+        else if (strncmp(argv[i], "-grep", 6) == 0)
         {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "GlobalLock() failed, GetLastError() = 0x%X",
-                GetLastError());
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 4;
+            if (argc > i+1)
+            {
+                i++;
+                pOptions->lineFilter.pPattern = argv[i];
+                pOptions->yLineFilter = 1;
+            }
         }
-        GlobalFree(hGlobalMem);
-        CloseClipboard();
-        return -1;
-    }
-
-    CopyMemory(pGlobalMem, pData, sizeBytes);
-    GlobalUnlock(hGlobalMem);
-
-    if (!SetClipboardData(format, hGlobalMem))
-    {
-        if (pEb != NULL)
+        else if (strncmp(argv[i], "-context", 9) == 0)
         {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "SetClipboardData() failed, GetLastError() = 0x%X",
-                GetLastError());
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 5;
-        }
-        GlobalFree(hGlobalMem);
-        CloseClipboard();
-        return -1;
-    }
-
-    CloseClipboard();
-    GlobalFree(hGlobalMem);
-
-    return 0;
-}
-
-/* SearchForStringList()
- *
- * Search for the first occurrence of any of an array of strings within a given
- * input string. Earlier entries in the array of search strings take higher
- * priority.
- *
- * Returns the character index (within the input string) of the first
- * occurrence of a found string. Returns -1 if none of the strings was found.
- * Stores the index of the search string within the given array of search
- * strings in an output variable if a string is found, otherwise the value of
- * the output pointer is undefined.
- */
-int SearchForStringList(const wchar_t *pInputString,
-                        unsigned int inputStringSizeBytes,
-                        const wchar_t **ppSearchStrings,
-                        unsigned int numberOfSearchStrings,
-                        unsigned int *pHitSearchStringIndex)
-{
-    unsigned int i;
-    unsigned int charPos = 0;
-
-    for (charPos = 0; charPos < inputStringSizeBytes / sizeof(wchar_t);
-        charPos++)
-    {
-        for (i = 0; i < numberOfSearchStrings; i++)
-        {
-            unsigned int cmpPos = 0;
-            while (ppSearchStrings[i][cmpPos] == pInputString[charPos+cmpPos]
-                && charPos + cmpPos < inputStringSizeBytes / sizeof(wchar_t))
+            if (argc > i+1)
             {
-                cmpPos++;
+                int val;
+                i++;
+                val = strtol(argv[i], NULL, 0);
+                if (val >= 0)
+                    pOptions->lineFilter.contextLines = (unsigned int)val;
             }
-            if (ppSearchStrings[i][cmpPos] == L'\0')
+        }
+        else if (strncmp(argv[i], "-emit", 6) == 0)
+        {
+            if (argc > i+1)
             {
-                /* found a search string */
-                *pHitSearchStringIndex = i;
-                return charPos;
+                i++;
+                if (strcmp(argv[i], "text") == 0 ||
+                    strcmp(argv[i], "all") == 0)
+                    pOptions->yEmitText = 1;
+                if (strcmp(argv[i], "html") == 0 ||
+                    strcmp(argv[i], "all") == 0)
+                    pOptions->yEmitHtml = 1;
             }
         }
-    }
-
-    /* none of the search strings was found */
-    return -1;
-}
-
-void ShiftFormatInfoPositions(FormatInfo *pFormatInfo,
-                              unsigned int startCharPos,
-                              unsigned int charactersDeleted,
-                              unsigned int charactersInserted)
-{
-    unsigned int i;
-
-    for (i = 0; i < pFormatInfo->numberOfTags; i++)
-    {
-        if (pFormatInfo->tags[i].characterPos > startCharPos)
+        else if (strncmp(argv[i], "-emitto", 8) == 0)
         {
-            /* tags that are within a deleted region:
-               move to the beginning of the deleted region */
-            if (pFormatInfo->tags[i].characterPos <
-                startCharPos + charactersDeleted)
+            if (argc > i+1)
             {
-                pFormatInfo->tags[i].characterPos = startCharPos;
+                i++;
+                pOptions->pEmitBaseName = argv[i];
             }
-            /* tags that are after a deleted region:
-               move right when more characters are inserted than deleted, move
-               left otherwise */
-            else
+        }
+        else if (strncmp(argv[i], "-preblock", 10) == 0)
+        {
+            if (argc > i+1)
             {
-                pFormatInfo->tags[i].characterPos +=
-                    charactersInserted - charactersDeleted;
+                int val;
+                i++;
+                val = strtol(argv[i], NULL, 0);
+                if (val >= 0)
+                {
+                    pOptions->preBlockSizeBytes = (unsigned int)val;
+                    pOptions->yPreBlockSizeOverride = 1;
+                }
             }
         }
-    }
-}
-
-// TODO ReplaceCharacters() documentation
-int ReplaceCharacters(const wchar_t *pInputBuffer,
-                      unsigned int inputBufSizeBytes,
-                      FormatInfo *pFormatInfo,
-                      const wchar_t **ppSearchStrings,
-                      const wchar_t **ppReplaceStrings,
-                      wchar_t **ppAllocatedBuffer,
-                      unsigned int *pAllocatedBufSizeBytes,
-                      ErrBlock *pEb)
-{
-    wchar_t *pOutputBuffer;
-    unsigned int numOfSearchStrings = 0;
-    unsigned int outputCharacters = 0;
-    unsigned int inputCharacterPos = 0;
-    unsigned int outputCharPos = 0;
-
-    while (ppSearchStrings[numOfSearchStrings] != NULL)
-        numOfSearchStrings++;
-
-    /* determine output size */
-    while (1)
-    {
-        unsigned int hitSearchStringIndex;
-        unsigned int searchStringCharacters;
-        unsigned int replaceCharacters;
-        int index;
-        index = SearchForStringList(pInputBuffer + inputCharacterPos,
-            inputBufSizeBytes - inputCharacterPos * sizeof(wchar_t),
-            ppSearchStrings, numOfSearchStrings, &hitSearchStringIndex);
-        if (index == -1)
+        else if (strncmp(argv[i], "-history", 9) == 0)
         {
-            outputCharacters +=
-                inputBufSizeBytes / sizeof(wchar_t) - inputCharacterPos;
-            break;
+            pOptions->yHistory = 1;
         }
-        searchStringCharacters = wcslen(ppSearchStrings[hitSearchStringIndex]);
-        replaceCharacters = wcslen(ppReplaceStrings[hitSearchStringIndex]);
-        outputCharacters += index + replaceCharacters;
-        inputCharacterPos += index + searchStringCharacters;
-    }
-
-    pOutputBuffer = malloc(outputCharacters * sizeof(wchar_t));
-    if (pOutputBuffer == NULL)
-    {
-        if (pEb != NULL)
+        else if (strncmp(argv[i], "-files", 7) == 0)
         {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "Could not allocate buffer for replacement text");
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 1;
-        }
-        return -1;
-    }
-
-    inputCharacterPos = 0;
-    while (1)
-    {
-        unsigned int hitSearchStringIndex;
-        unsigned int searchStringCharacters;
-        unsigned int replaceCharacters;
-        int index;
-        index = SearchForStringList(pInputBuffer + inputCharacterPos,
-            inputBufSizeBytes - inputCharacterPos * sizeof(wchar_t),
-            ppSearchStrings, numOfSearchStrings, &hitSearchStringIndex);
-        if (index == -1)
-        {
-            /* no more strings to replace - insert remaining input string */
-            memcpy(pOutputBuffer + outputCharPos,
-                pInputBuffer + inputCharacterPos,
-                inputBufSizeBytes - inputCharacterPos * sizeof(wchar_t));
-            outputCharPos +=
-                inputBufSizeBytes / sizeof(wchar_t) - inputCharacterPos;
+            /* all remaining arguments are input file names */
+            pOptions->ppInputFileNames = &argv[i+1];
+            pOptions->numberOfInputFiles = argc - (i+1);
             break;
         }
-
-        searchStringCharacters = wcslen(ppSearchStrings[hitSearchStringIndex]);
-        replaceCharacters = wcslen(ppReplaceStrings[hitSearchStringIndex]);
-
-        /* adapt FormatInfo structure tag positions */
-        ShiftFormatInfoPositions(pFormatInfo, index + outputCharPos,
-            searchStringCharacters, replaceCharacters);
-
-        /* insert input string up to characters to be replaced */
-        memcpy(pOutputBuffer + outputCharPos,
-            pInputBuffer + inputCharacterPos,
-            index * sizeof(wchar_t));
-        outputCharPos += index;
-
-        /* insert replacement string */
-        memcpy(pOutputBuffer + outputCharPos,
-            ppReplaceStrings[hitSearchStringIndex],
-            replaceCharacters * sizeof(wchar_t));
-        outputCharPos += replaceCharacters;
-        inputCharacterPos += index + searchStringCharacters;
-    }
-
-    if (outputCharacters != outputCharPos)
-    {
-        if (pEb != NULL)
+        else
         {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "Error in internal buffer size calculation");
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 2;
+            // TODO handle unsupported command line switches
         }
-        free(pOutputBuffer);
-        return -1;
     }
-
-    /* success */
-    *ppAllocatedBuffer = pOutputBuffer;
-    *pAllocatedBufSizeBytes = outputCharacters * sizeof(wchar_t);
-    return 0;
 }
 
-/* GenerateHtmlMarkupFromFormatInfoTag()
- *
- * Generate HTML code in UTF8 (without a zero termination byte) from a TagType,
- * a parameter and a boolean flag (indicating if the tag is a closing tag) and
- * store it at a specified address. When the specified buffer size is 0 no data
- * is written (for size calculation). Otherwise the function fails if the
- * specified buffer size if smaller than the generated HTML code.
- *
- * Returns the number of bytes required by the generated UTF8 string (without
- * a zero termination byte) on success or -1 in case of an error.
- */
-int GenerateHtmlMarkupFromFormatInfoTag(TagType type, unsigned parameter,
-                                        unsigned int yClose,
-                                        char *pOutputBuffer,
-                                        unsigned int bufferSizeBytes)
-{
-    int returnValue;
-    char *pTag = NULL;
-    unsigned int yFreeTagPointer = 0;
-
-    if (type == TagTypePreWithAttributes)
-    {
-        if (!yClose)
-            pTag = "<pre>";
-        else
-            pTag = "</pre>";
-    }
-    else if (type == TagTypeUnderscore)
-    {
-        if (!yClose)
-            pTag = "<u>";
-        else
-            pTag = "</u>";
-    }
-    else if (type == TagTypeBgBlue)
-    {
-        // TODO more tag types in GenerateHtmlMarkupFromFormatInfoTag()
-        pTag = "<blue>";
-    }
-
-    if (pTag == NULL)
-        return -1;
-
-    returnValue = strlen(pTag);
-
-    if (bufferSizeBytes != 0)
-    {
-        if (bufferSizeBytes >= (unsigned int)returnValue)
-            snprintf(pOutputBuffer, returnValue, pTag);
-        else
-            returnValue = -1;
-    }
-
-    if (yFreeTagPointer)
-        free(pTag);
-
-    return returnValue;
-
-    //<span style="color: rgb(0, 0, 0);
-    //    font-family: Verdana, Arial, Helvetica, sans-serif;
-    //    font-size: medium; font-style: normal;
-    //    font-variant: normal; font-weight: normal;
-    //    letter-spacing: normal;
-    //    line-height: 18px;
-    //    orphans: auto;
-    //    text-align: left;
-    //    text-indent: 0px;
-    //    text-transform: none;
-    //    white-space: normal;
-    //    widows: auto;
-    //    word-spacing: 0px;
-    //    -webkit-text-stroke-width: 0px;
-    //    background-color: rgb(255, 255, 255);
-    //    display: inline !important;
-    //    float: none;">intention o</span>
-}
-
-/* GenerateClipboardHtml()
- *
- * Generate HTML code in the CF_HTML clipboard format (not zero terminated)
- * from a wide character input buffer (does not need to be zero terminated) and
- * an optional FormatInfo structure and store it in an allocated buffer. Stores
- * the address of the allocated buffer (which must be released by the caller)
- * and the size of the allocated buffer in output variables. When the
- * FormatInfo pointer is NULL no formatting is applied to the HTML output.
- *
- * Returns zero on success or -1 in case of an error. In case of an error
- * and when the error block pointer is not NULL the error block is filled with
- * an error description. When an error occurrs no buffer must be released by
- * the caller and the values of the output pointers are undefined.
- */
-int GenerateClipboardHtml(const wchar_t *pInputBuffer,
-                          unsigned int inputBufSizeBytes,
-                          const FormatInfo *pFormatInfo,
-                          char **ppAllocatedHtmlBuffer,
-                          unsigned int *pAllocatedHtmlBufSizeBytes,
-                          ErrBlock *pEb)
+int main(int argc, char *argv[])
 {
-    char *pStartString = "Version:0.9\r\nStartHTML:0000000105\r\n"
-        "EndHTML:0000000000\r\nStartFragment:0000000141\r\n"
-        "EndFragment:0000000000\r\n<html>\r\n<body>\r\n<!--StartFragment-->";
-    char *pEndString = "<!--EndFragment-->\r\n</body>\r\n</html>";
-    char *pOutputBuffer;
-    ErrBlock replaceCharactersErrBlock;
-    wchar_t *pReplacedInputBuffer;
-    unsigned int replacedInputBufferSizeBytes;
-    FormatInfo *pOwnFormatInfo;
-    unsigned int formatInfoTotalTags;
-    unsigned int formatInfoTagIndex = 0;
-    unsigned int inputCharacterPos = 0;
-    unsigned int nextTagSearchStartPos = 0;
-    unsigned int outputBufWriteIndex = 0;
-    unsigned int outputBufRemainingBytes;
-    unsigned int htmlSizeBytes;
-    unsigned int i;
+    HANDLE standardin = GetStdHandle(STD_INPUT_HANDLE);
+    char *pInputBuffer;
+    Arena inputArena;           /* the input until the program ends */
+    Arena readArena;            /* the unfiltered input with -grep */
+    RenderContext *pRenderContext;
+    unsigned int inputBufferSizeStep;
+    unsigned int preBlockSizeBytes;
+    unsigned int totalReadBytes;
+    unsigned int bomSizeBytes = 0;
+    unsigned int yDetectCodepage = 0;
+    unsigned int codepage;
     int retval;
-    // TODO zero terminate GenerateClipboardHtml() output?
+    ErrBlock eb;
+    CmdLineOptions opt;
+    ClipboardOptions clipboardOptions;
 
-    /* create FormatInfo structure derived from pFormatInfo parameter */
-    formatInfoTotalTags = (
-            /* tags from pFormatInfo input parameter */
-            (pFormatInfo == NULL ? 0 : pFormatInfo->numberOfTags) +
-            /* opening and closing <pre> tag */
-            2);
-    pOwnFormatInfo = malloc(
-            /* space for FormatInfo structure without any tags */
-            sizeof(*pFormatInfo) - sizeof(pFormatInfo->tags) +
-            /* space for tags */
-            formatInfoTotalTags * sizeof(pFormatInfo->tags));
-    if (pOwnFormatInfo == NULL)
-    {
-        if (pEb != NULL)
-        {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "Could not allocate buffer for FormatInfo structure");
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 1;
-        }
-        return -1;
-    }
-    pOwnFormatInfo->numberOfTags = formatInfoTotalTags;
+    ParseCommandLineOptions(argc, argv, &opt);
 
-    /* insert <pre> tag around everything (open) */
-    pOwnFormatInfo->tags[formatInfoTagIndex].characterPos = 0;
-    pOwnFormatInfo->tags[formatInfoTagIndex].type = TagTypePreWithAttributes;
-    pOwnFormatInfo->tags[formatInfoTagIndex].parameter = 0;
-    pOwnFormatInfo->tags[formatInfoTagIndex].yClose = 0;
-    formatInfoTagIndex++;
-    // TODO set attributes for <pre> tag
+    if (opt.yInputBufferSizeStepOverride)
+        inputBufferSizeStep = opt.inputBufferSizeStep;
+    else
+        inputBufferSizeStep = 4096;
 
-    /* copy tags from pFormatInfo input parameter */
-    if (pFormatInfo != NULL)
-    {
-        memcpy(&(pOwnFormatInfo->tags[formatInfoTagIndex]), pFormatInfo->tags,
-            pFormatInfo->numberOfTags * sizeof(pFormatInfo->tags));
-        formatInfoTagIndex += pFormatInfo->numberOfTags;
-    }
+    if (opt.yPreBlockSizeOverride)
+        preBlockSizeBytes = opt.preBlockSizeBytes;
+    else
+        preBlockSizeBytes = 0;
 
-    /* insert <pre> tag around everything (close) */
-    pOwnFormatInfo->tags[formatInfoTagIndex].characterPos =
-        inputBufSizeBytes / sizeof(wchar_t);
-    pOwnFormatInfo->tags[formatInfoTagIndex].type = TagTypePreWithAttributes;
-    pOwnFormatInfo->tags[formatInfoTagIndex].parameter = 0;
-    pOwnFormatInfo->tags[formatInfoTagIndex].yClose = 1;
-    formatInfoTagIndex++;
+    InitClipboardOptions(&clipboardOptions);
+    if (opt.yClipboardTimeoutOverride)
+        clipboardOptions.timeoutMs = opt.clipboardTimeoutMs;
+    clipboardOptions.yHistory = opt.yHistory;
+    if (opt.yStats)
+        atexit(PrintStats);
 
-    /* sanity check: FormatInfo structure filled correctly? */
-    if (formatInfoTagIndex != formatInfoTotalTags)
+    if (opt.yOutputClipboard)
     {
-        if (pEb != NULL)
+        HANDLE standardout = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (standardout == INVALID_HANDLE_VALUE)
         {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "Error in internal FormatInfo size calculation");
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 2;
+            fprintf(stderr, "Could not open standard output handle\n");
+            exit(1);
         }
-        free(pOwnFormatInfo);
-        return -1;
-    }
 
-    {
-        wchar_t *ppSearchStrings[] = {L"\"", L"&", L"<", L">", NULL};
-        wchar_t *ppReplaceStrings[] = {L"&quot;", L"&amp;", L"&lt;", L"&gt;", NULL};
-        retval = ReplaceCharacters(pInputBuffer, inputBufSizeBytes,
-            pOwnFormatInfo, ppSearchStrings, ppReplaceStrings,
-            &pReplacedInputBuffer, &replacedInputBufferSizeBytes,
-            &replaceCharactersErrBlock);
-    }
-    if (retval == -1)
-    {
-        if (pEb != NULL)
+        if (opt.yCodepageOverride)
+            codepage = opt.codepage;
+        else if (GetFileType(standardout) == FILE_TYPE_DISK)
+            /* stdout is redirected to a file - use system default codepage */
+            codepage = GetACP();
+        else
+            /* stdout is a console or a pipe - use console codepage */
+            codepage = GetConsoleOutputCP();
+
+        SetAllocationStage(AllocationStageClipboard);
+        retval = ReadClipboardToFile(standardout, opt.yOutputHtml, codepage,
+            &clipboardOptions, &eb);
+        if (retval != 0)
         {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "Replacing control characters failed (%s)",
-                replaceCharactersErrBlock.errDescription);
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 3;
+            fprintf(stderr, "ERROR: ReadClipboardToFile() returned %d\n"
+                "    %s\n", retval, eb.errDescription);
+            exit(1);
         }
-        free(pOwnFormatInfo);
-        return -1;
+        exit(0);
     }
 
-    /* determine output size: input string as UTF8 */
-    retval = WideCharToMultiByte(CP_UTF8, 0, pReplacedInputBuffer,
-        replacedInputBufferSizeBytes / sizeof(wchar_t), NULL, 0, NULL, NULL);
-    if (retval == 0)
+    if (opt.yRecall)
     {
-        if (pEb != NULL)
+        /* publish an entry of the clipboard history again, 1 being the most
+           recent one */
+        SetAllocationStage(AllocationStageClipboard);
+        retval = RecallClipboardHistoryEntry(opt.recallEntryNumber,
+            &clipboardOptions, &eb);
+        if (retval != 0)
         {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "WideCharToMultiByte() space detection failed, "
-                "GetLastError() = 0x%X", GetLastError());
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 4;
+            fprintf(stderr, "ERROR: RecallClipboardHistoryEntry() returned "
+                "%d\n    %s\n", retval, eb.errDescription);
+            exit(1);
         }
-        free(pReplacedInputBuffer);
-        free(pOwnFormatInfo);
-        return -1;
+        exit(0);
     }
-    htmlSizeBytes = (unsigned int)retval;
 
-    /* determine output size: description + fixed start and end HTML code */
-    htmlSizeBytes += strlen(pStartString) + strlen(pEndString);
-
-    /* determine output size: generated HTML tags */
-    for (i = 0; i < pOwnFormatInfo->numberOfTags; i++)
+    if (opt.numberOfInputFiles != 0 && (opt.yEmitText || opt.yEmitHtml))
     {
-        retval = GenerateHtmlMarkupFromFormatInfoTag(
-            pOwnFormatInfo->tags[i].type,
-            pOwnFormatInfo->tags[i].parameter,
-            pOwnFormatInfo->tags[i].yClose,
-            NULL,
-            0);
-        if (retval == -1)
-        {
-            if (pEb != NULL)
-            {
-                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                    "HTML tag space detection for tag type 0x%X with "
-                    "parameter 0x%X failed", pOwnFormatInfo->tags[i].type,
-                    pOwnFormatInfo->tags[i].parameter);
-                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-                pEb->functionSpecificErrorCode = 5;
-            }
-            free(pReplacedInputBuffer);
-            free(pOwnFormatInfo);
-            return -1;
-        }
-        htmlSizeBytes += (unsigned int)retval;
+        fprintf(stderr, "ERROR: -emit is not supported with -files\n");
+        exit(1);
     }
 
-    /* allocate the output buffer */
-    outputBufRemainingBytes = htmlSizeBytes;
-    pOutputBuffer = malloc(htmlSizeBytes);
-    if (pOutputBuffer == NULL)
+    /* the UTF16 text and the UTF8 HTML cannot share the standard output */
+    if (opt.yEmitText && opt.yEmitHtml && opt.pEmitBaseName == NULL)
     {
-        if (pEb != NULL)
-        {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "Could not allocate buffer for HTML data");
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 6;
-        }
-        free(pReplacedInputBuffer);
-        free(pOwnFormatInfo);
-        return -1;
+        fprintf(stderr, "ERROR: -emit all requires -emitto\n");
+        exit(1);
     }
 
-    /* fill buffer: description and HTML until <!--StartFragment--> */
-    retval = (int)strlen(pStartString);
-    strncpy(pOutputBuffer + outputBufWriteIndex, pStartString, retval);
-    outputBufWriteIndex += retval;
-    outputBufRemainingBytes -= retval;
-
-    while (1)
+    if (opt.numberOfInputFiles != 0)
     {
-        unsigned int yFoundNextTag = 0;
-        unsigned int nextTagCharacter;
-        unsigned int inputCharsToConvert;
-
-        nextTagCharacter = replacedInputBufferSizeBytes / sizeof(wchar_t);
-        for (i = 0; i < pOwnFormatInfo->numberOfTags; i++)
-        {
-            if (pOwnFormatInfo->tags[i].characterPos <= nextTagCharacter &&
-                pOwnFormatInfo->tags[i].characterPos >= nextTagSearchStartPos)
-            {
-                nextTagCharacter = pOwnFormatInfo->tags[i].characterPos;
-                yFoundNextTag = 1;
-            }
-        }
-
-        if (yFoundNextTag)
-        {
-            /* convert input characters up to next tag */
-            inputCharsToConvert = nextTagCharacter - inputCharacterPos;
-            nextTagSearchStartPos = nextTagCharacter + 1;
-        }
+        /* input files on disk - detect the codepage, defaulting to the
+           system default codepage */
+        if (opt.yCodepageOverride)
+            codepage = opt.codepage;
         else
-        {
-            /* convert all remaining input characters */
-            inputCharsToConvert = (replacedInputBufferSizeBytes /
-                sizeof(wchar_t)) - inputCharacterPos;
-        }
-
-        /* fill buffer: convert input characters */
-        if (inputCharsToConvert != 0)
-        {
-            retval = WideCharToMultiByte(CP_UTF8, 0, pReplacedInputBuffer +
-                    inputCharacterPos, inputCharsToConvert, pOutputBuffer +
-                    outputBufWriteIndex, outputBufRemainingBytes, NULL, NULL);
-            if (retval == 0)
-            {
-                if (pEb != NULL)
-                {
-                    snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                        "WideCharToMultiByte() conversion failed, "
-                        "GetLastError() = 0x%X", GetLastError());
-                    pEb->errDescription[
-                        sizeof(pEb->errDescription) - 1] = '\0';
-                    pEb->functionSpecificErrorCode = 7;
-                }
-                free(pOutputBuffer);
-                free(pReplacedInputBuffer);
-                free(pOwnFormatInfo);
-                return -1;
-            }
-            outputBufWriteIndex += retval;
-            outputBufRemainingBytes -= retval;
-        }
-        inputCharacterPos += inputCharsToConvert;
-
-        /* exit the loop if there are no more tags to write */
-        if (!yFoundNextTag)
-            break;
-
-        /* fill buffer: insert all tags at that position */
-        for (i = 0; i < pOwnFormatInfo->numberOfTags; i++)
-        {
-            if (pOwnFormatInfo->tags[i].characterPos == inputCharacterPos)
-            {
-                retval = GenerateHtmlMarkupFromFormatInfoTag(
-                        pOwnFormatInfo->tags[i].type,
-                        pOwnFormatInfo->tags[i].parameter,
-                        pOwnFormatInfo->tags[i].yClose,
-                        pOutputBuffer + outputBufWriteIndex,
-                        outputBufRemainingBytes);
-                if (retval == -1)
-                {
-                    if (pEb != NULL)
-                    {
-                        snprintf(pEb->errDescription,
-                            sizeof(pEb->errDescription),
-                            "HTML tag generation for tag type 0x%X with "
-                            "parameter 0x%X failed",
-                            pOwnFormatInfo->tags[i].type,
-                            pOwnFormatInfo->tags[i].parameter);
-                        pEb->errDescription[
-                            sizeof(pEb->errDescription) - 1] = '\0';
-                        pEb->functionSpecificErrorCode = 8;
-                    }
-                    free(pOutputBuffer);
-                    free(pReplacedInputBuffer);
-                    free(pOwnFormatInfo);
-                    return -1;
-                }
-                outputBufWriteIndex += retval;
-                outputBufRemainingBytes -= retval;
-            }
-        }
-    }
-
-    /* free buffers that are not needed anymore */
-    free(pReplacedInputBuffer);
-    free(pOwnFormatInfo);
-
-    /* fill buffer: <!--EndFragment--> and closing HTML tags */
-    retval = (int)strlen(pEndString);
-    strncpy(pOutputBuffer + outputBufWriteIndex, pEndString, retval);
-    outputBufWriteIndex += retval;
-    outputBufRemainingBytes -= retval;
-
-    /* correct EndHTML and EndFragment in the description */
-    snprintf(pOutputBuffer + 0x2B, 10, "%010u", htmlSizeBytes);
-    snprintf(pOutputBuffer + 0x5D, 10, "%010u", htmlSizeBytes - 36);
+            codepage = GetACP();
 
-    /* sanity check: buffer filled exactly to the end? */
-    if (outputBufWriteIndex != htmlSizeBytes || outputBufRemainingBytes != 0)
-    {
-        if (pEb != NULL)
-        {
-            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
-                "Error in internal buffer size calculation");
-            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
-            pEb->functionSpecificErrorCode = 9;
+        /* the files are read, filtered and rendered concurrently, so all of
+           it is counted as rendering */
+        SetAllocationStage(AllocationStageRender);
+        retval = CopyInputFilesToClipboard(opt.ppInputFileNames,
+            opt.numberOfInputFiles, codepage, !opt.yCodepageOverride,
+            inputBufferSizeStep,
+            opt.yLineSelection ? &opt.lineSelection : NULL,
+            opt.yLineFilter ? &opt.lineFilter : NULL,
+            opt.highlightLanguage, opt.yCrlf, preBlockSizeBytes,
+            &clipboardOptions, &eb);
+        if (retval != 0)
+        {
+            fprintf(stderr, "ERROR: CopyInputFilesToClipboard() returned %d\n"
+                "    %s\n", retval, eb.errDescription);
+            exit(1);
         }
-        free(pOutputBuffer);
-        return -1;
+        exit(0);
     }
 
-    /* success */
-    *ppAllocatedHtmlBuffer = pOutputBuffer;
-    *pAllocatedHtmlBufSizeBytes = htmlSizeBytes;
-    return 0;
-}
-
-/* ExtractFormatInfoFromAnsiEscape()
- *
- * TODO ExtractFormatInfoFromAnsiEscape() documentation
- */
-int ExtractFormatInfoFromAnsiEscape(const wchar_t *pInputBuffer,
-                                    unsigned int inputBufSizeBytes,
-                                    FormatInfo **ppAllocatedFormatInfo,
-                                    wchar_t **ppAllocatedWideCharBuffer,
-                                    unsigned int *pAllocatedBufSizeBytes,
-                                    ErrBlock *pEb)
-{
-    //TODO implement ExtractFormatInfoFromAnsiEscape()
-}
-
-int main(int argc, char *argv[])
-{
-    HANDLE standardin = GetStdHandle(STD_INPUT_HANDLE);
-    char *pInputBuffer;
-    wchar_t *pWideCharBuf;
-    unsigned int inputBufferSizeStep;
-    unsigned int totalReadBytes;
-    unsigned int wideCharBufSizeBytes;
-    unsigned int codepage;
-    int retval;
-    ErrBlock eb;
-    CmdLineOptions opt;
-
-    ParseCommandLineOptions(argc, argv, &opt);
-
-    if (opt.yInputBufferSizeStepOverride)
-        inputBufferSizeStep = opt.inputBufferSizeStep;
-    else
-        inputBufferSizeStep = 4096;
-
     if (standardin == INVALID_HANDLE_VALUE)
     {
         fprintf(stderr, "Could not open standard input handle\n");
@@ -1031,6 +438,10 @@ int main(int argc, char *argv[])
     else
     {
         unsigned int fileType = GetFileType(standardin);
+
+        /* redirected input from files and other programs is often in a
+           different codepage, the codepage below is only the default */
+        yDetectCodepage = (fileType != FILE_TYPE_CHAR);
         if (fileType == FILE_TYPE_DISK)
         {
             /* stdin is redirected to a file - use system default codepage */
@@ -1058,53 +469,138 @@ int main(int argc, char *argv[])
         }
     }
 
-    retval = ReadFileToNewBuffer(standardin, inputBufferSizeStep,
-        &pInputBuffer, &totalReadBytes, &eb);
-    if (retval != 0)
+    /* lines are selected at single line feed bytes, which splits UTF16
+       characters */
+    if (opt.yLineSelection && (codepage == CODEPAGE_UTF16LE ||
+        codepage == CODEPAGE_UTF16BE))
     {
-        fprintf(stderr, "ERROR: ReadFileToNewBuffer() returned %d\n    %s\n",
-            retval, eb.errDescription);
+        fprintf(stderr, "ERROR: -lines and -tail do not support UTF16 "
+            "input\n");
         exit(1);
     }
 
-    retval = ConvToZeroTerminatedWideCharNewBuffer(pInputBuffer,
-        totalReadBytes, codepage, &pWideCharBuf, &wideCharBufSizeBytes, &eb);
+    InitArena(&inputArena);
+    InitArena(&readArena);
+    SetAllocationStage(AllocationStageRead);
+    retval = ReadFileLinesToNewBuffer(standardin, inputBufferSizeStep,
+        opt.yLineSelection ? &opt.lineSelection : NULL,
+        opt.yLineFilter ? &readArena : &inputArena, &pInputBuffer,
+        &totalReadBytes, &eb);
     if (retval != 0)
     {
-        fprintf(stderr, "ERROR: ConvToZeroTerminatedWideCharNewBuffer() "
-            "returned %d\n    %s\n", retval, eb.errDescription);
-        free(pInputBuffer);
+        fprintf(stderr, "ERROR: ReadFileLinesToNewBuffer() returned %d\n"
+            "    %s\n", retval, eb.errDescription);
+        exit(1);
+    }
+
+    if (yDetectCodepage)
+    {
+        codepage = DetectInputCodepage(pInputBuffer, totalReadBytes, codepage,
+            &bomSizeBytes);
+        if (opt.yLineSelection && (codepage == CODEPAGE_UTF16LE ||
+            codepage == CODEPAGE_UTF16BE))
+        {
+            fprintf(stderr, "ERROR: -lines and -tail do not support UTF16 "
+                "input\n");
+            FreeArena(&readArena);
+            FreeArena(&inputArena);
+            exit(1);
+        }
+    }
+
+    /* filter in the input codepage, after the codepage is known */
+    if (opt.yLineFilter)
+    {
+        char *pFilteredBuffer;
+
+        SetAllocationStage(AllocationStageFilter);
+        retval = FilterLinesToNewBuffer(pInputBuffer + bomSizeBytes,
+            totalReadBytes - bomSizeBytes, codepage, &opt.lineFilter,
+            &inputArena, &pFilteredBuffer, &totalReadBytes, &eb);
+        FreeArena(&readArena);
+        if (retval != 0)
+        {
+            fprintf(stderr, "ERROR: FilterLinesToNewBuffer() returned %d\n"
+                "    %s\n", retval, eb.errDescription);
+            exit(1);
+        }
+        pInputBuffer = pFilteredBuffer;
+        bomSizeBytes = 0;
+    }
+
+    SetAllocationStage(AllocationStageRender);
+    pRenderContext = CreateRenderContext();
+    if (pRenderContext == NULL)
+    {
+        fprintf(stderr, "Could not allocate render context\n");
+        FreeArena(&inputArena);
         exit(1);
     }
+    pRenderContext->preBlockSizeBytes = preBlockSizeBytes;
 
-    free(pInputBuffer);
+    if (opt.yEmitText || opt.yEmitHtml)
+    {
+        /* write the clipboard formats to stdout or files instead of the
+           clipboard */
+        HANDLE textFile = INVALID_HANDLE_VALUE;
+        HANDLE htmlFile = INVALID_HANDLE_VALUE;
 
-    // TODO create format info
+        if (opt.yEmitText)
+            textFile = OpenEmitFile(opt.pEmitBaseName, ".txt");
+        if (opt.yEmitHtml)
+            htmlFile = OpenEmitFile(opt.pEmitBaseName, ".html");
+        if ((opt.yEmitText && textFile == INVALID_HANDLE_VALUE) ||
+            (opt.yEmitHtml && htmlFile == INVALID_HANDLE_VALUE))
+        {
+            fprintf(stderr, "ERROR: Could not open the -emit output, "
+                "GetLastError() = 0x%X\n", GetLastError());
+            retval = -1;
+        }
+        else
+        {
+            retval = EmitText(pRenderContext, pInputBuffer + bomSizeBytes,
+                totalReadBytes - bomSizeBytes, codepage,
+                opt.highlightLanguage, opt.yCrlf, textFile, htmlFile, &eb);
+            if (retval != 0)
+            {
+                fprintf(stderr, "ERROR: EmitText() returned %d\n    %s\n",
+                    retval, eb.errDescription);
+            }
+        }
+        if (opt.pEmitBaseName != NULL && textFile != INVALID_HANDLE_VALUE)
+            CloseHandle(textFile);
+        if (opt.pEmitBaseName != NULL && htmlFile != INVALID_HANDLE_VALUE)
+            CloseHandle(htmlFile);
+        FreeRenderContext(pRenderContext);
+        FreeArena(&inputArena);
+        exit(retval != 0 ? 1 : 0);
+    }
 
-    // TODO REMOVE DEBUG CODE (GENERATE + SET CLIPBOARD HTML DATA)
-    if (1)
+    /* the input buffer has spare bytes for a terminator, so UTF16LE input
+       is the clipboard text itself */
+    retval = RenderTextInPlace(pRenderContext, pInputBuffer + bomSizeBytes,
+        totalReadBytes - bomSizeBytes, codepage, opt.highlightLanguage,
+        opt.yCrlf, &eb);
+    if (retval != 0)
     {
-        char *pHtmlBuf_;
-        unsigned int htmlBufLenBytes_;
-        _getch();
-        retval = GenerateClipboardHtml(pWideCharBuf, wideCharBufSizeBytes - 2,
-            NULL, &pHtmlBuf_, &htmlBufLenBytes_, &eb);
-        if (retval == -1) exit(1);
-        retval = WriteToClipboard(RegisterClipboardFormat("HTML Format"),
-                    pHtmlBuf_, htmlBufLenBytes_, &eb);
-        if (retval == -1) exit(1);
-        exit(0);
+        fprintf(stderr, "ERROR: RenderTextInPlace() returned %d\n    %s\n",
+            retval, eb.errDescription);
+        FreeRenderContext(pRenderContext);
+        FreeArena(&inputArena);
+        exit(1);
     }
 
-    retval = WriteToClipboard(CF_UNICODETEXT, pWideCharBuf,
-        wideCharBufSizeBytes, &eb);
+    SetAllocationStage(AllocationStageClipboard);
+    retval = PublishRenderedText(pRenderContext, &clipboardOptions, &eb);
     if (retval != 0)
     {
-        fprintf(stderr, "ERROR: WriteToClipboard() returned %d\n    %s\n",
+        fprintf(stderr, "ERROR: PublishRenderedText() returned %d\n    %s\n",
             retval, eb.errDescription);
-        free(pWideCharBuf);
+        FreeRenderContext(pRenderContext);
+        FreeArena(&inputArena);
         exit(1);
     }
 
-    free(pWideCharBuf);
+    FreeRenderContext(pRenderContext);
+    FreeArena(&inputArena);
 }
@@ -0,0 +1,543 @@
+/* cclipbench
+ * Benchmark of rendering many small texts with libcclip
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif /* #ifdef _MSC_VER */
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcclip.h"
+
+/* a small snippet as typically copied from a terminal */
+static const char benchmarkText[] =
+    "/* copy a string */\r\n"
+    "int CopyString(char *pDest, const char *pSrc, unsigned int size)\r\n"
+    "{\r\n"
+    "    unsigned int i;\r\n"
+    "    for (i = 0; i + 1 < size && pSrc[i] != '\\0'; i++)\r\n"
+    "        pDest[i] = pSrc[i];\r\n"
+    "    pDest[i] = '\\0';\r\n"
+    "    return (int)i; // \"done\" <ok> & more\r\n"
+    "}\r\n";
+
+/* BenchmarkRenderText()
+ *
+ * Render the benchmark text a number of times with one RenderContext and
+ * print the renders per second and the allocations after the first (warm-up)
+ * render, which fail the benchmark because the retained buffers of the
+ * context must suffice.
+ *
+ * Returns zero on success or -1 in case of an error.
+ */
+int BenchmarkRenderText(unsigned int codepage, HighlightLanguage language,
+                        unsigned int yCrlf, const char *pDescription,
+                        unsigned int iterations)
+{
+    RenderContext *pContext;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER startTime;
+    LARGE_INTEGER endTime;
+    AllocationStats warmStats;
+    AllocationStats stats;
+    unsigned int numberOfAllocations;
+    unsigned int i;
+    double seconds;
+    ErrBlock eb;
+
+    SetAllocationStage(AllocationStageRender);
+    pContext = CreateRenderContext();
+    if (pContext == NULL)
+    {
+        fprintf(stderr, "Could not allocate render context\n");
+        return -1;
+    }
+
+    /* warm-up: the retained buffers are allocated */
+    if (RenderText(pContext, benchmarkText, sizeof(benchmarkText) - 1,
+        codepage, language, yCrlf, &eb))
+    {
+        fprintf(stderr, "ERROR: RenderText() failed\n    %s\n",
+            eb.errDescription);
+        FreeRenderContext(pContext);
+        return -1;
+    }
+    GetAllocationStats(AllocationStageRender, &warmStats);
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&startTime);
+    for (i = 0; i < iterations; i++)
+    {
+        if (RenderText(pContext, benchmarkText, sizeof(benchmarkText) - 1,
+            codepage, language, yCrlf, &eb))
+        {
+            fprintf(stderr, "ERROR: RenderText() failed\n    %s\n",
+                eb.errDescription);
+            FreeRenderContext(pContext);
+            return -1;
+        }
+    }
+    QueryPerformanceCounter(&endTime);
+    seconds = (double)(endTime.QuadPart - startTime.QuadPart) /
+        (double)frequency.QuadPart;
+
+    GetAllocationStats(AllocationStageRender, &stats);
+    numberOfAllocations =
+        (stats.numberOfAllocations - warmStats.numberOfAllocations) +
+        (stats.numberOfReallocations - warmStats.numberOfReallocations);
+
+    printf("%-24s %10.0f renders/s %8.1f MB/s  HTML %u bytes, "
+        "%u allocations after warm-up\n", pDescription,
+        iterations / seconds,
+        iterations * (double)(sizeof(benchmarkText) - 1) / seconds / 1e6,
+        pContext->htmlBufSizeBytes, numberOfAllocations);
+
+    FreeRenderContext(pContext);
+    if (numberOfAllocations != 0)
+    {
+        fprintf(stderr, "ERROR: %s allocated after warm-up\n",
+            pDescription);
+        return -1;
+    }
+    return 0;
+}
+
+/* BenchmarkPreBlocks()
+ *
+ * Render a large text made of copies of the benchmark text with syntax
+ * highlighting for each <pre> block size (see InitPreTags(), the
+ * sizes are terminated by 0 and the first render is without blocks) and
+ * print how much the HTML code grows by closing and reopening the tags at
+ * the block boundaries.
+ *
+ * Returns zero on success or -1 in case of an error.
+ */
+int BenchmarkPreBlocks(unsigned int textSizeBytes,
+                       const unsigned int *pBlockSizes)
+{
+    RenderContext *pContext;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER startTime;
+    LARGE_INTEGER endTime;
+    char *pText;
+    unsigned int numberOfCopies = textSizeBytes / (sizeof(benchmarkText) - 1);
+    unsigned int unsplitHtmlSizeBytes = 0;
+    unsigned int blockSizeBytes = 0;
+    unsigned int i;
+    double seconds;
+    ErrBlock eb;
+
+    textSizeBytes = numberOfCopies * (sizeof(benchmarkText) - 1);
+    /* the text shares the lifetime of the context */
+    pContext = CreateRenderContext();
+    pText = (pContext == NULL ? NULL :
+        ArenaAlloc(&pContext->arena, textSizeBytes));
+    if (pText == NULL)
+    {
+        fprintf(stderr, "Could not allocate benchmark text\n");
+        FreeRenderContext(pContext);
+        return -1;
+    }
+    for (i = 0; i < numberOfCopies; i++)
+    {
+        memcpy(pText + i * (sizeof(benchmarkText) - 1), benchmarkText,
+            sizeof(benchmarkText) - 1);
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    for (i = 0; i == 0 || pBlockSizes[i - 1] != 0; i++)
+    {
+        blockSizeBytes = (i == 0 ? 0 : pBlockSizes[i - 1]);
+        pContext->preBlockSizeBytes = blockSizeBytes;
+        QueryPerformanceCounter(&startTime);
+        if (RenderText(pContext, pText, textSizeBytes, CP_UTF8,
+            HighlightLanguageC, 0, &eb))
+        {
+            fprintf(stderr, "ERROR: RenderText() failed\n    %s\n",
+                eb.errDescription);
+            FreeRenderContext(pContext);
+            return -1;
+        }
+        QueryPerformanceCounter(&endTime);
+        seconds = (double)(endTime.QuadPart - startTime.QuadPart) /
+            (double)frequency.QuadPart;
+
+        if (i == 0)
+        {
+            unsplitHtmlSizeBytes = pContext->htmlBufSizeBytes;
+            printf("%-24s %10u bytes HTML %15s %8.1f ms\n", "one <pre>",
+                unsplitHtmlSizeBytes, "", seconds * 1e3);
+        }
+        else
+        {
+            printf("%-16s %7u %10u bytes HTML %+7.3f %% growth %8.1f ms\n",
+                "<pre> blocks of", blockSizeBytes, pContext->htmlBufSizeBytes,
+                100.0 * ((double)pContext->htmlBufSizeBytes -
+                unsplitHtmlSizeBytes) / unsplitHtmlSizeBytes, seconds * 1e3);
+        }
+    }
+
+    FreeRenderContext(pContext);
+    return 0;
+}
+
+/* input of CheckAllocationStages(): copies of the benchmark text, read in
+   steps like the standard input of cclip */
+#define CHECK_TEXT_COPIES 256
+#define CHECK_TEXT_BYTES (CHECK_TEXT_COPIES * (sizeof(benchmarkText) - 1))
+#define CHECK_READ_STEP 4096
+
+/* expected allocations of a stage: exact counts and the most bytes that may
+   be allocated at once */
+typedef struct StageExpectation_
+{
+    const char *pStageName;
+    unsigned int numberOfAllocations;
+    unsigned int numberOfReallocations;
+    unsigned int numberOfFrees;
+    size_t maxPeakBytes;
+} StageExpectation;
+
+/* CheckStageAllocations()
+ *
+ * Compare the allocation statistics of a stage with the expectation and
+ * print them.
+ *
+ * Returns zero when they match or -1 otherwise.
+ */
+int CheckStageAllocations(AllocationStage stage,
+                          const StageExpectation *pExpectation)
+{
+    AllocationStats stats;
+
+    GetAllocationStats(stage, &stats);
+    printf("%-10s %3u allocations, %3u reallocations, %3u frees, "
+        "peak %8lu bytes (at most %lu)\n", pExpectation->pStageName,
+        stats.numberOfAllocations, stats.numberOfReallocations,
+        stats.numberOfFrees, (unsigned long)stats.peakBytes,
+        (unsigned long)pExpectation->maxPeakBytes);
+    if (stats.numberOfAllocations != pExpectation->numberOfAllocations ||
+        stats.numberOfReallocations != pExpectation->numberOfReallocations ||
+        stats.numberOfFrees != pExpectation->numberOfFrees ||
+        stats.peakBytes > pExpectation->maxPeakBytes)
+    {
+        fprintf(stderr, "ERROR: %s stage expected %u allocations, "
+            "%u reallocations, %u frees and a peak of at most %lu bytes\n",
+            pExpectation->pStageName, pExpectation->numberOfAllocations,
+            pExpectation->numberOfReallocations,
+            pExpectation->numberOfFrees,
+            (unsigned long)pExpectation->maxPeakBytes);
+        return -1;
+    }
+    return 0;
+}
+
+/* CheckAllocationStages()
+ *
+ * Run the stages of cclip for redirected standard input on a temporary file
+ * with a line filter, highlighting and CR LF line endings and check the
+ * allocations of every stage (see StageExpectation). The clipboard stage
+ * only releases the buffers, so that the check does not replace the
+ * clipboard of the build machine. Must run before anything else allocates,
+ * because the statistics count from the start of the program.
+ *
+ * Returns zero when all stages match or -1 otherwise.
+ */
+int CheckAllocationStages(void)
+{
+    /* reading grows one buffer step by step, filtering keeps the read
+       buffer until the filtered copy is complete, rendering adds the wide
+       character, UTF8 and HTML texts to the filtered input and the
+       clipboard stage releases all of it; the peak budgets leave room for
+       the growth steps of the buffers and for the arena blocks */
+    static const StageExpectation expectations[NUMBER_OF_ALLOCATION_STAGES] =
+    {
+        {"setup", 0, 0, 0, 0},
+        {"read", 1, 16, 0, CHECK_TEXT_BYTES + 2 * CHECK_READ_STEP},
+        {"filter", 2, 3, 1, 2 * CHECK_TEXT_BYTES},
+        {"render", 7, 4, 0, 4 * CHECK_TEXT_BYTES},
+        {"clipboard", 0, 0, 9, 4 * CHECK_TEXT_BYTES}
+    };
+    static const LineFilter lineFilter = {"pSrc\\[i\\]", 1};
+    char tempPath[MAX_PATH];
+    char tempFileName[MAX_PATH];
+    HANDLE fileHandle;
+    LARGE_INTEGER fileStart;
+    Arena readArena;
+    Arena inputArena;
+    RenderContext *pContext;
+    char *pInputBuffer;
+    char *pFilteredBuffer;
+    unsigned int inputSizeBytes;
+    unsigned int i;
+    int retval = 0;
+    ErrBlock eb;
+
+    /* setup: the input is written without allocations */
+    if (GetTempPath(sizeof(tempPath), tempPath) == 0 ||
+        GetTempFileName(tempPath, "ccb", 0, tempFileName) == 0)
+    {
+        fprintf(stderr, "ERROR: No temporary file name, GetLastError() = "
+            "0x%X\n", GetLastError());
+        return -1;
+    }
+    fileHandle = CreateFile(tempFileName, GENERIC_READ | GENERIC_WRITE, 0,
+        NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        fprintf(stderr, "ERROR: Could not create \"%s\", GetLastError() = "
+            "0x%X\n", tempFileName, GetLastError());
+        return -1;
+    }
+    for (i = 0; i < CHECK_TEXT_COPIES; i++)
+    {
+        if (WriteAllToFile(fileHandle, benchmarkText,
+            sizeof(benchmarkText) - 1, &eb))
+        {
+            fprintf(stderr, "ERROR: WriteAllToFile() failed\n    %s\n",
+                eb.errDescription);
+            CloseHandle(fileHandle);
+            return -1;
+        }
+    }
+    fileStart.QuadPart = 0;
+    SetFilePointerEx(fileHandle, fileStart, NULL, FILE_BEGIN);
+    InitArena(&readArena);
+    InitArena(&inputArena);
+
+    SetAllocationStage(AllocationStageRead);
+    retval = ReadFileLinesToNewBuffer(fileHandle, CHECK_READ_STEP, NULL,
+        &readArena, (void **)&pInputBuffer, &inputSizeBytes, &eb);
+    CloseHandle(fileHandle);
+    if (retval != 0)
+    {
+        fprintf(stderr, "ERROR: ReadFileLinesToNewBuffer() failed\n    %s\n",
+            eb.errDescription);
+        return -1;
+    }
+
+    SetAllocationStage(AllocationStageFilter);
+    retval = FilterLinesToNewBuffer(pInputBuffer, inputSizeBytes, 1252,
+        &lineFilter, &inputArena, &pFilteredBuffer, &inputSizeBytes, &eb);
+    FreeArena(&readArena);
+    if (retval != 0)
+    {
+        fprintf(stderr, "ERROR: FilterLinesToNewBuffer() failed\n    %s\n",
+            eb.errDescription);
+        FreeArena(&inputArena);
+        return -1;
+    }
+
+    SetAllocationStage(AllocationStageRender);
+    pContext = CreateRenderContext();
+    if (pContext == NULL)
+    {
+        fprintf(stderr, "Could not allocate render context\n");
+        FreeArena(&inputArena);
+        return -1;
+    }
+    retval = RenderTextInPlace(pContext, pFilteredBuffer, inputSizeBytes,
+        1252, HighlightLanguageC, 1, &eb);
+    if (retval != 0)
+    {
+        fprintf(stderr, "ERROR: RenderTextInPlace() failed\n    %s\n",
+            eb.errDescription);
+    }
+
+    SetAllocationStage(AllocationStageClipboard);
+    FreeRenderContext(pContext);
+    FreeArena(&inputArena);
+    if (retval != 0)
+        return -1;
+
+    printf("allocations of %u bytes of input filtered to %u bytes\n",
+        (unsigned int)CHECK_TEXT_BYTES, inputSizeBytes);
+    for (i = 0; i < NUMBER_OF_ALLOCATION_STAGES; i++)
+    {
+        if (CheckStageAllocations((AllocationStage)i, &expectations[i]))
+            retval = -1;
+    }
+    return retval;
+}
+
+#ifdef _DEBUG
+/* simulated contention of CheckClipboardBackoff(): the refused attempts of
+   an acquisition that succeeds and the timeout of one that cannot */
+#define CHECK_REFUSED_ATTEMPTS 6
+#define CHECK_FAILURE_TIMEOUT_MS 20
+
+/* FindAcquireBucket()
+ *
+ * Returns the time-to-acquire histogram bucket of a time as documented for
+ * CLIPBOARD_ACQUIRE_HISTOGRAM_BUCKETS.
+ */
+unsigned int FindAcquireBucket(double timeMs)
+{
+    unsigned int bucket = 0;
+    double bucketEndMs = 1.0;
+
+    while (bucket < CLIPBOARD_ACQUIRE_HISTOGRAM_BUCKETS - 1 &&
+        timeMs >= bucketEndMs)
+    {
+        bucket++;
+        bucketEndMs *= 2.0;
+    }
+    return bucket;
+}
+
+/* CheckClipboardBackoff()
+ *
+ * Open the clipboard with AcquireClipboard() while the
+ * CCLIP_SIMULATE_CONTENTION environment variable of debug builds refuses
+ * the first attempts, once with a timeout long enough to get through and
+ * once with a short timeout that all attempts are refused for, and check
+ * the retry and failure counters and the histogram of the statistics. The
+ * clipboard contents are not changed. Must run before anything else opens
+ * the clipboard, because the statistics count from the start of the
+ * program.
+ *
+ * Returns zero when the statistics match or -1 otherwise.
+ */
+int CheckClipboardBackoff(void)
+{
+    ClipboardAcquisitionStats stats;
+    char contentionSetting[64];
+    unsigned int expectedBucket;
+    unsigned int i;
+    int retval = 0;
+    ErrBlock eb;
+
+    /* the attempts after the refused ones open the clipboard */
+    sprintf(contentionSetting, "CCLIP_SIMULATE_CONTENTION=%u",
+        CHECK_REFUSED_ATTEMPTS);
+    _putenv(contentionSetting);
+    if (AcquireClipboard(1000, &eb))
+    {
+        fprintf(stderr, "ERROR: AcquireClipboard() failed\n    %s\n",
+            eb.errDescription);
+        _putenv("CCLIP_SIMULATE_CONTENTION=");
+        return -1;
+    }
+    CloseClipboard();
+    GetClipboardAcquisitionStats(&stats);
+    expectedBucket = FindAcquireBucket(stats.maxAcquireTimeMs);
+    printf("acquired   %3u retries, %3u failures, %.3f ms in bucket %u\n",
+        stats.numberOfRetries, stats.numberOfFailures,
+        stats.maxAcquireTimeMs, expectedBucket);
+    if (stats.numberOfAcquisitions != 1 ||
+        stats.numberOfRetries != CHECK_REFUSED_ATTEMPTS ||
+        stats.numberOfFailures != 0)
+    {
+        fprintf(stderr, "ERROR: expected 1 acquisition with %u retries and "
+            "no failures\n", CHECK_REFUSED_ATTEMPTS);
+        retval = -1;
+    }
+    for (i = 0; i < CLIPBOARD_ACQUIRE_HISTOGRAM_BUCKETS; i++)
+    {
+        if (stats.histogram[i] != (i == expectedBucket ? 1u : 0u))
+        {
+            fprintf(stderr, "ERROR: histogram bucket %u counts %u "
+                "acquisitions\n", i, stats.histogram[i]);
+            retval = -1;
+        }
+    }
+
+    /* every attempt is refused until the timeout has passed */
+    _putenv("CCLIP_SIMULATE_CONTENTION=1000000");
+    if (AcquireClipboard(CHECK_FAILURE_TIMEOUT_MS, &eb) == 0)
+    {
+        fprintf(stderr, "ERROR: AcquireClipboard() succeeded despite the "
+            "simulated contention\n");
+        CloseClipboard();
+        retval = -1;
+    }
+    else if (eb.functionSpecificErrorCode != 1)
+    {
+        fprintf(stderr, "ERROR: AcquireClipboard() failed with error code "
+            "%u instead of the timeout\n    %s\n",
+            eb.functionSpecificErrorCode, eb.errDescription);
+        retval = -1;
+    }
+    _putenv("CCLIP_SIMULATE_CONTENTION=");
+    GetClipboardAcquisitionStats(&stats);
+    printf("timed out  %3u retries, %3u failures after %u ms\n",
+        stats.numberOfRetries - CHECK_REFUSED_ATTEMPTS,
+        stats.numberOfFailures, CHECK_FAILURE_TIMEOUT_MS);
+    /* the retries of a failure depend on the timer resolution, but the
+       first attempt is refused well before the timeout */
+    if (stats.numberOfAcquisitions != 1 ||
+        stats.numberOfRetries <= CHECK_REFUSED_ATTEMPTS ||
+        stats.numberOfFailures != 1 ||
+        stats.histogram[expectedBucket] != 1)
+    {
+        fprintf(stderr, "ERROR: expected 1 failure with retries and no "
+            "further acquisition\n");
+        retval = -1;
+    }
+    return retval;
+}
+#endif /* #ifdef _DEBUG */
+
+int main(int argc, char *argv[])
+{
+    static const unsigned int preBlockSizes[] =
+        {1024, 4096, 16384, 65536, 1048576, 0};
+    unsigned int iterations = 200000;
+
+    /* -check runs only the checks, as a build step; the clipboard backoff
+       needs the simulated contention of debug builds */
+    if (argc > 1 && strcmp(argv[1], "-check") == 0)
+    {
+        if (CheckAllocationStages())
+            return 1;
+#ifdef _DEBUG
+        if (CheckClipboardBackoff())
+            return 1;
+#endif
+        return 0;
+    }
+
+    if (argc > 1 && strtol(argv[1], NULL, 0) > 0)
+        iterations = (unsigned int)strtol(argv[1], NULL, 0);
+
+    printf("%u renders of %u bytes each\n", iterations,
+        (unsigned int)(sizeof(benchmarkText) - 1));
+    if (BenchmarkRenderText(CP_UTF8, HighlightLanguageNone, 0, "UTF8",
+            iterations) ||
+        BenchmarkRenderText(1252, HighlightLanguageNone, 0, "cp1252",
+            iterations) ||
+        BenchmarkRenderText(CP_UTF8, HighlightLanguageNone, 1, "UTF8 CRLF",
+            iterations) ||
+        BenchmarkRenderText(1252, HighlightLanguageNone, 1, "cp1252 CRLF",
+            iterations) ||
+        BenchmarkRenderText(CP_UTF8, HighlightLanguageC, 0, "UTF8 highlighted",
+            iterations))
+    {
+        exit(1);
+    }
+
+    printf("\nhighlighted text of %u bytes in <pre> blocks\n", 16u << 20);
+    if (BenchmarkPreBlocks(16u << 20, preBlockSizes))
+        exit(1);
+
+    return 0;
+}
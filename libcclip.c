@@ -0,0 +1,6736 @@
+/* libcclip
+ * Rendering functions of cclip for use in other programs
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#define snprintf _snprintf
+#endif /* #ifdef _MSC_VER */
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || \
+    defined(__SSE2__)
+#define CCLIP_USE_SSE2
+#include <emmintrin.h>
+#endif /* #if defined(_M_X64) || ... */
+
+#include "libcclip.h"
+
+/* every block of AllocMemory() starts with a header that stores its size,
+   the header size keeps the alignment of malloc() */
+#define MEMORY_HEADER_BYTES 16
+
+/* byte counters of the allocation statistics have the pointer size, so that
+   they are updated with the interlocked functions of that size */
+#ifdef _WIN64
+typedef LONGLONG AllocationBytes;
+#define InterlockedExchangeAddBytes InterlockedExchangeAdd64
+#define InterlockedCompareExchangeBytes InterlockedCompareExchange64
+#else
+typedef LONG AllocationBytes;
+#define InterlockedExchangeAddBytes InterlockedExchangeAdd
+#define InterlockedCompareExchangeBytes InterlockedCompareExchange
+#endif /* #ifdef _WIN64 */
+
+/* allocation statistics of one stage */
+typedef struct StageCounters_
+{
+    LONG volatile numberOfAllocations;
+    LONG volatile numberOfReallocations;
+    LONG volatile numberOfFrees;
+    AllocationBytes volatile peakBytes;
+} StageCounters;
+
+/* allocation statistics of all stages, updated with interlocked functions
+   and without a lock because the worker threads of
+   CopyInputFilesToClipboard() allocate concurrently */
+typedef struct AllocationAccounting_
+{
+    LONG volatile stage;
+    AllocationBytes volatile currentBytes;
+    StageCounters stages[NUMBER_OF_ALLOCATION_STAGES];
+} AllocationAccounting;
+
+static AllocationAccounting allocationAccounting;
+
+/* RaiseAllocationPeak()
+ *
+ * Raise the peak of the allocated bytes of a stage to a given number of
+ * allocated bytes if it is lower, retrying when another thread changes the
+ * peak at the same time.
+ */
+void RaiseAllocationPeak(StageCounters *pCounters, AllocationBytes bytes)
+{
+    AllocationBytes peakBytes = pCounters->peakBytes;
+
+    while (bytes > peakBytes)
+    {
+        AllocationBytes previousPeakBytes = InterlockedCompareExchangeBytes(
+            &pCounters->peakBytes, bytes, peakBytes);
+
+        if (previousPeakBytes == peakBytes)
+            break;
+        peakBytes = previousPeakBytes;
+    }
+}
+
+/* CountAllocation()
+ *
+ * Account a change of the allocated bytes from oldBytes to newBytes in the
+ * current stage, incrementing the given counter of the stage statistics
+ * (0 for allocations, 1 for reallocations and 2 for releases).
+ */
+void CountAllocation(unsigned int counter, size_t oldBytes, size_t newBytes)
+{
+    StageCounters *pCounters =
+        &allocationAccounting.stages[allocationAccounting.stage];
+    AllocationBytes deltaBytes = (AllocationBytes)newBytes -
+        (AllocationBytes)oldBytes;
+
+    if (counter == 0)
+        InterlockedIncrement(&pCounters->numberOfAllocations);
+    else if (counter == 1)
+        InterlockedIncrement(&pCounters->numberOfReallocations);
+    else
+        InterlockedIncrement(&pCounters->numberOfFrees);
+    if (deltaBytes > 0)
+    {
+        RaiseAllocationPeak(pCounters, InterlockedExchangeAddBytes(
+            &allocationAccounting.currentBytes, deltaBytes) + deltaBytes);
+    }
+    else
+    {
+        InterlockedExchangeAddBytes(&allocationAccounting.currentBytes,
+            deltaBytes);
+    }
+}
+
+/* AllocMemory()
+ *
+ * Allocate memory like malloc() and count the allocation in the current
+ * stage (see SetAllocationStage()). The memory must be released with
+ * FreeMemory().
+ *
+ * Returns the address of the memory or NULL if it could not be allocated.
+ */
+void *AllocMemory(size_t sizeBytes)
+{
+    char *pBlock = malloc(MEMORY_HEADER_BYTES + sizeBytes);
+
+    if (pBlock == NULL)
+        return NULL;
+    *(size_t *)pBlock = sizeBytes;
+    CountAllocation(0, 0, sizeBytes);
+    return pBlock + MEMORY_HEADER_BYTES;
+}
+
+/* ReallocMemory()
+ *
+ * Change the size of memory from AllocMemory() like realloc() (a NULL
+ * address allocates new memory) and count the reallocation in the current
+ * stage.
+ *
+ * Returns the new address of the memory or NULL if it could not be
+ * allocated, in which case the old memory is unchanged.
+ */
+void *ReallocMemory(void *pMemory, size_t sizeBytes)
+{
+    char *pBlock;
+    size_t oldSizeBytes;
+
+    if (pMemory == NULL)
+        return AllocMemory(sizeBytes);
+
+    pBlock = (char *)pMemory - MEMORY_HEADER_BYTES;
+    oldSizeBytes = *(size_t *)pBlock;
+    pBlock = realloc(pBlock, MEMORY_HEADER_BYTES + sizeBytes);
+    if (pBlock == NULL)
+        return NULL;
+    *(size_t *)pBlock = sizeBytes;
+    CountAllocation(1, oldSizeBytes, sizeBytes);
+    return pBlock + MEMORY_HEADER_BYTES;
+}
+
+/* FreeMemory()
+ *
+ * Release memory from AllocMemory() or ReallocMemory() (may be NULL) and
+ * count the release in the current stage.
+ */
+void FreeMemory(void *pMemory)
+{
+    char *pBlock;
+
+    if (pMemory == NULL)
+        return;
+    pBlock = (char *)pMemory - MEMORY_HEADER_BYTES;
+    CountAllocation(2, *(size_t *)pBlock, 0);
+    free(pBlock);
+}
+
+/* SetAllocationStage()
+ *
+ * Count the following allocations in the given stage. The peak of the new
+ * stage starts with the bytes allocated so far.
+ */
+void SetAllocationStage(AllocationStage stage)
+{
+    InterlockedExchange(&allocationAccounting.stage, (LONG)stage);
+    RaiseAllocationPeak(&allocationAccounting.stages[stage],
+        allocationAccounting.currentBytes);
+}
+
+/* GetAllocationStats()
+ *
+ * Copy the allocation statistics of a stage.
+ */
+void GetAllocationStats(AllocationStage stage, AllocationStats *pStats)
+{
+    const StageCounters *pCounters = &allocationAccounting.stages[stage];
+
+    pStats->numberOfAllocations =
+        (unsigned int)pCounters->numberOfAllocations;
+    pStats->numberOfReallocations =
+        (unsigned int)pCounters->numberOfReallocations;
+    pStats->numberOfFrees = (unsigned int)pCounters->numberOfFrees;
+    pStats->peakBytes = (size_t)pCounters->peakBytes;
+}
+
+/* allocations of an arena up to this size share blocks of ARENA_BLOCK_BYTES,
+   larger ones get a block of their own that ArenaRealloc() can grow in
+   place */
+#define ARENA_BLOCK_BYTES 4096
+#define ARENA_SHARED_MAX_BYTES (ARENA_BLOCK_BYTES / 4)
+
+/* InitArena()
+ *
+ * Initialize an empty arena (see Arena).
+ */
+void InitArena(Arena *pArena)
+{
+    pArena->pBlocks = NULL;
+}
+
+/* ArenaAlloc()
+ *
+ * Allocate memory from an arena. Small allocations are taken from the
+ * current block or start a new block of ARENA_BLOCK_BYTES, larger ones get
+ * a block of their own, which is linked behind the current block so that
+ * its free space is still used. The memory is released with the arena
+ * (see FreeArena()).
+ *
+ * Returns the address of the memory (aligned like malloc()) or NULL if it
+ * could not be allocated.
+ */
+void *ArenaAlloc(Arena *pArena, size_t sizeBytes)
+{
+    ArenaBlock *pBlock = pArena->pBlocks;
+    size_t alignedSizeBytes = (sizeBytes + MEMORY_HEADER_BYTES - 1) &
+        ~(size_t)(MEMORY_HEADER_BYTES - 1);
+    void *pMemory;
+
+    if (alignedSizeBytes > ARENA_SHARED_MAX_BYTES)
+    {
+        pBlock = AllocMemory(sizeof(ArenaBlock) + alignedSizeBytes);
+        if (pBlock == NULL)
+            return NULL;
+        pBlock->sizeBytes = alignedSizeBytes;
+        pBlock->usedBytes = alignedSizeBytes;
+        pBlock->yOwnBlock = 1;
+        if (pArena->pBlocks == NULL)
+        {
+            pBlock->pNext = NULL;
+            pArena->pBlocks = pBlock;
+        }
+        else
+        {
+            pBlock->pNext = pArena->pBlocks->pNext;
+            pArena->pBlocks->pNext = pBlock;
+        }
+        return pBlock + 1;
+    }
+
+    if (pBlock == NULL || pBlock->sizeBytes - pBlock->usedBytes <
+        alignedSizeBytes)
+    {
+        pBlock = AllocMemory(sizeof(ArenaBlock) + ARENA_BLOCK_BYTES);
+        if (pBlock == NULL)
+            return NULL;
+        pBlock->pNext = pArena->pBlocks;
+        pBlock->sizeBytes = ARENA_BLOCK_BYTES;
+        pBlock->usedBytes = 0;
+        pBlock->yOwnBlock = 0;
+        pArena->pBlocks = pBlock;
+    }
+
+    pMemory = (char *)(pBlock + 1) + pBlock->usedBytes;
+    pBlock->usedBytes += alignedSizeBytes;
+    return pMemory;
+}
+
+/* ArenaRealloc()
+ *
+ * Change the size of memory from an arena like realloc() (a NULL address
+ * allocates new memory), given its old size. Memory with a block of its own
+ * is reallocated with ReallocMemory() and the last allocation of the
+ * current block grows in place when the block has room for it; other memory
+ * is copied to a new allocation, its old space is released with the arena.
+ *
+ * Returns the new address of the memory or NULL if it could not be
+ * allocated, in which case the old memory is unchanged.
+ */
+void *ArenaRealloc(Arena *pArena, void *pMemory, size_t oldSizeBytes,
+                   size_t sizeBytes)
+{
+    ArenaBlock **ppLink;
+    ArenaBlock *pBlock;
+    size_t alignedOldSizeBytes = (oldSizeBytes + MEMORY_HEADER_BYTES - 1) &
+        ~(size_t)(MEMORY_HEADER_BYTES - 1);
+    size_t alignedSizeBytes = (sizeBytes + MEMORY_HEADER_BYTES - 1) &
+        ~(size_t)(MEMORY_HEADER_BYTES - 1);
+    void *pNewMemory;
+
+    if (pMemory == NULL)
+        return ArenaAlloc(pArena, sizeBytes);
+
+    /* the block of the memory and the link pointing to it */
+    for (ppLink = &pArena->pBlocks; *ppLink != NULL;
+        ppLink = &(*ppLink)->pNext)
+    {
+        if ((char *)pMemory >= (char *)(*ppLink + 1) &&
+            (char *)pMemory < (char *)(*ppLink + 1) + (*ppLink)->sizeBytes)
+        {
+            break;
+        }
+    }
+    pBlock = *ppLink;
+
+    if (pBlock != NULL && pBlock->yOwnBlock)
+    {
+        pBlock = ReallocMemory(pBlock, sizeof(ArenaBlock) + alignedSizeBytes);
+        if (pBlock == NULL)
+            return NULL;
+        pBlock->sizeBytes = alignedSizeBytes;
+        pBlock->usedBytes = alignedSizeBytes;
+        *ppLink = pBlock;
+        return pBlock + 1;
+    }
+    if (pBlock != NULL && pBlock == pArena->pBlocks &&
+        (char *)pMemory + alignedOldSizeBytes ==
+        (char *)(pBlock + 1) + pBlock->usedBytes &&
+        pBlock->sizeBytes - pBlock->usedBytes + alignedOldSizeBytes >=
+        alignedSizeBytes)
+    {
+        pBlock->usedBytes = pBlock->usedBytes - alignedOldSizeBytes +
+            alignedSizeBytes;
+        return pMemory;
+    }
+
+    pNewMemory = ArenaAlloc(pArena, sizeBytes);
+    if (pNewMemory == NULL)
+        return NULL;
+    memcpy(pNewMemory, pMemory,
+        oldSizeBytes < sizeBytes ? oldSizeBytes : sizeBytes);
+    return pNewMemory;
+}
+
+/* FreeArena()
+ *
+ * Release all memory of an arena, which stays usable (empty).
+ */
+void FreeArena(Arena *pArena)
+{
+    while (pArena->pBlocks != NULL)
+    {
+        ArenaBlock *pNext = pArena->pBlocks->pNext;
+
+        FreeMemory(pArena->pBlocks);
+        pArena->pBlocks = pNext;
+    }
+}
+
+/* ReadFileToNewBuffer()
+ *
+ * Allocate a buffer from an arena and fill it with data from a given file
+ * handle. Stores the address of the allocated buffer (released with the
+ * arena) and the number of read bytes in output variables. The size of the
+ * allocated buffer is not returned but will be the next multiple of
+ * bufferSizeStep greater than the returned number of read bytes, with at
+ * least sizeof(wchar_t) spare bytes behind the data (see
+ * RenderTextInPlace()).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. When an error occurrs the values of the output
+ * pointers are undefined.
+ */
+int ReadFileToNewBuffer(HANDLE fileHandle, unsigned int bufferSizeStep,
+                        Arena *pArena, void **ppAllocatedBuffer,
+                        unsigned int *pReadBytes, ErrBlock *pEb)
+{
+    char *pInputBuffer = NULL;
+    unsigned int inputBufferSize = 0;
+    unsigned int yEndOfInput = 0;
+    unsigned int totalReadBytes = 0;
+
+    while (!yEndOfInput)
+    {
+        unsigned int bufferRemainingBytes;
+        char *pReadPointer;
+
+        pInputBuffer = ArenaRealloc(pArena, pInputBuffer, inputBufferSize,
+            inputBufferSize + bufferSizeStep);
+        pReadPointer = pInputBuffer + inputBufferSize;
+        inputBufferSize += bufferSizeStep;
+        bufferRemainingBytes = bufferSizeStep;
+        if (pInputBuffer == NULL)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "Could not allocate memory for input buffer");
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 1;
+            }
+            return -1;
+        }
+
+        do
+        {
+            unsigned int readBytes;
+            if (!ReadFile(fileHandle, pReadPointer, bufferRemainingBytes,
+                &readBytes, NULL))
+            {
+                unsigned int err = GetLastError();
+                if (err == ERROR_BROKEN_PIPE)
+                {
+                    yEndOfInput = 1;
+                    break;
+                }
+                else
+                {
+                    if (pEb != NULL)
+                    {
+                        // TODO multiple ErrBlock types + function for output
+                        //  - description in errDescription[]
+                        //  - GetLastError() number stored, later printed via FormatMessageW()
+                        //  - more?
+                        snprintf(pEb->errDescription,
+                            sizeof(pEb->errDescription),
+                            "ReadFile() failed, GetLastError() = 0x%X",
+                            GetLastError());
+                        pEb->errDescription[
+                            sizeof(pEb->errDescription) - 1] = '\0';
+                        pEb->functionSpecificErrorCode = 2;
+                    }
+                    return -1;
+                }
+            }
+
+            pReadPointer += readBytes;
+            bufferRemainingBytes -= readBytes;
+
+            if (readBytes == 0)
+            {
+                yEndOfInput = 1;
+                break;
+            }
+        } while (bufferRemainingBytes != 0);
+
+        totalReadBytes += (bufferSizeStep - bufferRemainingBytes);
+    }
+
+    /* room for a wide character terminator behind the data */
+    if (inputBufferSize - totalReadBytes < sizeof(wchar_t))
+    {
+        char *pNewBuffer = ArenaRealloc(pArena, pInputBuffer,
+            inputBufferSize, inputBufferSize + bufferSizeStep);
+        if (pNewBuffer == NULL)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "Could not allocate memory for input buffer");
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 1;
+            }
+            return -1;
+        }
+        pInputBuffer = pNewBuffer;
+    }
+
+    /* success */
+    *ppAllocatedBuffer = pInputBuffer;
+    *pReadBytes = totalReadBytes;
+    return 0;
+}
+
+/* decode tables for common single-byte codepages (index = input byte) */
+static const wchar_t decodeTableCp437[256] =
+{
+    0x0000, 0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007,
+    0x0008, 0x0009, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E, 0x000F,
+    0x0010, 0x0011, 0x0012, 0x0013, 0x0014, 0x0015, 0x0016, 0x0017,
+    0x0018, 0x0019, 0x001A, 0x001B, 0x001C, 0x001D, 0x001E, 0x001F,
+    0x0020, 0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027,
+    0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
+    0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+    0x0038, 0x0039, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x003F,
+    0x0040, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+    0x0048, 0x0049, 0x004A, 0x004B, 0x004C, 0x004D, 0x004E, 0x004F,
+    0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+    0x0058, 0x0059, 0x005A, 0x005B, 0x005C, 0x005D, 0x005E, 0x005F,
+    0x0060, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+    0x0068, 0x0069, 0x006A, 0x006B, 0x006C, 0x006D, 0x006E, 0x006F,
+    0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+    0x0078, 0x0079, 0x007A, 0x007B, 0x007C, 0x007D, 0x007E, 0x007F,
+    0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+    0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+    0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+    0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+    0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+    0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+    0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+    0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+    0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+    0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+    0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+    0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+    0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4,
+    0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+    0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248,
+    0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0
+};
+
+static const wchar_t decodeTableCp850[256] =
+{
+    0x0000, 0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007,
+    0x0008, 0x0009, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E, 0x000F,
+    0x0010, 0x0011, 0x0012, 0x0013, 0x0014, 0x0015, 0x0016, 0x0017,
+    0x0018, 0x0019, 0x001A, 0x001B, 0x001C, 0x001D, 0x001E, 0x001F,
+    0x0020, 0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027,
+    0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
+    0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+    0x0038, 0x0039, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x003F,
+    0x0040, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+    0x0048, 0x0049, 0x004A, 0x004B, 0x004C, 0x004D, 0x004E, 0x004F,
+    0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+    0x0058, 0x0059, 0x005A, 0x005B, 0x005C, 0x005D, 0x005E, 0x005F,
+    0x0060, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+    0x0068, 0x0069, 0x006A, 0x006B, 0x006C, 0x006D, 0x006E, 0x006F,
+    0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+    0x0078, 0x0079, 0x007A, 0x007B, 0x007C, 0x007D, 0x007E, 0x007F,
+    0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+    0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+    0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+    0x00FF, 0x00D6, 0x00DC, 0x00F8, 0x00A3, 0x00D8, 0x00D7, 0x0192,
+    0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+    0x00BF, 0x00AE, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+    0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x00C1, 0x00C2, 0x00C0,
+    0x00A9, 0x2563, 0x2551, 0x2557, 0x255D, 0x00A2, 0x00A5, 0x2510,
+    0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x00E3, 0x00C3,
+    0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x00A4,
+    0x00F0, 0x00D0, 0x00CA, 0x00CB, 0x00C8, 0x0131, 0x00CD, 0x00CE,
+    0x00CF, 0x2518, 0x250C, 0x2588, 0x2584, 0x00A6, 0x00CC, 0x2580,
+    0x00D3, 0x00DF, 0x00D4, 0x00D2, 0x00F5, 0x00D5, 0x00B5, 0x00FE,
+    0x00DE, 0x00DA, 0x00DB, 0x00D9, 0x00FD, 0x00DD, 0x00AF, 0x00B4,
+    0x00AD, 0x00B1, 0x2017, 0x00BE, 0x00B6, 0x00A7, 0x00F7, 0x00B8,
+    0x00B0, 0x00A8, 0x00B7, 0x00B9, 0x00B3, 0x00B2, 0x25A0, 0x00A0
+};
+
+static const wchar_t decodeTableCp1252[256] =
+{
+    0x0000, 0x0001, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x0007,
+    0x0008, 0x0009, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E, 0x000F,
+    0x0010, 0x0011, 0x0012, 0x0013, 0x0014, 0x0015, 0x0016, 0x0017,
+    0x0018, 0x0019, 0x001A, 0x001B, 0x001C, 0x001D, 0x001E, 0x001F,
+    0x0020, 0x0021, 0x0022, 0x0023, 0x0024, 0x0025, 0x0026, 0x0027,
+    0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
+    0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037,
+    0x0038, 0x0039, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x003F,
+    0x0040, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047,
+    0x0048, 0x0049, 0x004A, 0x004B, 0x004C, 0x004D, 0x004E, 0x004F,
+    0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057,
+    0x0058, 0x0059, 0x005A, 0x005B, 0x005C, 0x005D, 0x005E, 0x005F,
+    0x0060, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067,
+    0x0068, 0x0069, 0x006A, 0x006B, 0x006C, 0x006D, 0x006E, 0x006F,
+    0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077,
+    0x0078, 0x0079, 0x007A, 0x007B, 0x007C, 0x007D, 0x007E, 0x007F,
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+    0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+    0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+    0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+    0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+    0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+    0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+    0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+    0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+    0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+    0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+    0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+    0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF
+};
+
+typedef struct SingleByteCodepage_
+{
+    unsigned int codepage;
+    const wchar_t *pDecodeTable;
+} SingleByteCodepage;
+
+static const SingleByteCodepage singleByteCodepages[] =
+{
+    {437, decodeTableCp437},
+    {850, decodeTableCp850},
+    {1252, decodeTableCp1252}
+};
+
+/* GetSingleByteDecodeTable()
+ *
+ * Look up the 256 entry decode table for a given single-byte codepage.
+ *
+ * Returns a pointer to the decode table or NULL if there is no built-in table
+ * for the codepage (the conversion must then be done by the OS).
+ */
+const wchar_t *GetSingleByteDecodeTable(unsigned int codepage)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(singleByteCodepages) /
+        sizeof(singleByteCodepages[0]); i++)
+    {
+        if (singleByteCodepages[i].codepage == codepage)
+            return singleByteCodepages[i].pDecodeTable;
+    }
+    return NULL;
+}
+
+/* DecodeSingleByteString()
+ *
+ * Convert a string (not zero terminated) in a single-byte codepage to wide
+ * characters using a decode table. The output buffer must have space for
+ * numberOfInputBytes wide characters. Runs of ASCII characters are widened
+ * 16 bytes at a time when SSE2 is available.
+ */
+void DecodeSingleByteString(const unsigned char *pInput,
+                            unsigned int numberOfInputBytes,
+                            const wchar_t *pDecodeTable,
+                            wchar_t *pOutput)
+{
+    unsigned int i = 0;
+#ifdef CCLIP_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+
+    while (i + 16 <= numberOfInputBytes)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(pInput + i));
+        if (_mm_movemask_epi8(chunk) != 0)
+        {
+            /* non-ASCII byte somewhere in the chunk - use the table */
+            unsigned int end = i + 16;
+            for (; i < end; i++)
+                pOutput[i] = pDecodeTable[pInput[i]];
+            continue;
+        }
+        _mm_storeu_si128((__m128i *)(pOutput + i),
+            _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128((__m128i *)(pOutput + i + 8),
+            _mm_unpackhi_epi8(chunk, zero));
+        i += 16;
+    }
+#endif /* #ifdef CCLIP_USE_SSE2 */
+
+    for (; i < numberOfInputBytes; i++)
+        pOutput[i] = pDecodeTable[pInput[i]];
+}
+
+/* CountBits16()
+ *
+ * Returns the number of set bits in a 16 bit value.
+ */
+unsigned int CountBits16(unsigned int value)
+{
+    value = (value & 0x5555) + ((value >> 1) & 0x5555);
+    value = (value & 0x3333) + ((value >> 2) & 0x3333);
+    value = (value & 0x0F0F) + ((value >> 4) & 0x0F0F);
+    return (value & 0xFF) + (value >> 8);
+}
+
+/* CountLoneLineFeeds()
+ *
+ * Count the line feed bytes that do not follow a carriage return, 16 bytes
+ * at a time when SSE2 is available.
+ *
+ * Returns the number of line feeds that need a carriage return for CR LF
+ * line endings.
+ */
+unsigned int CountLoneLineFeeds(const char *pInput,
+                                unsigned int numberOfInputBytes)
+{
+    unsigned int numberOfLoneLineFeeds = 0;
+    unsigned int i = 0;
+#ifdef CCLIP_USE_SSE2
+    const __m128i lineFeed = _mm_set1_epi8('\n');
+    const __m128i carriageReturn = _mm_set1_epi8('\r');
+    unsigned int previousCarriageReturn = 0;
+
+    while (i + 16 <= numberOfInputBytes)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(pInput + i));
+        unsigned int lineFeedMask = (unsigned int)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(chunk, lineFeed));
+        unsigned int carriageReturnMask = (unsigned int)_mm_movemask_epi8(
+            _mm_cmpeq_epi8(chunk, carriageReturn));
+
+        /* a line feed is lone unless the bit before it is a carriage
+           return, bit 0 depends on the last byte of the previous chunk */
+        if (lineFeedMask != 0)
+        {
+            numberOfLoneLineFeeds += CountBits16(lineFeedMask &
+                ~((carriageReturnMask << 1) | previousCarriageReturn) &
+                0xFFFF);
+        }
+        previousCarriageReturn = carriageReturnMask >> 15;
+        i += 16;
+    }
+#endif /* #ifdef CCLIP_USE_SSE2 */
+
+    for (; i < numberOfInputBytes; i++)
+    {
+        if (pInput[i] == '\n' && (i == 0 || pInput[i - 1] != '\r'))
+            numberOfLoneLineFeeds++;
+    }
+
+    return numberOfLoneLineFeeds;
+}
+
+/* CountLineFeeds()
+ *
+ * Count the line feed bytes of a buffer, 16 bytes at a time when SSE2 is
+ * available.
+ *
+ * Returns the number of line feeds.
+ */
+unsigned int CountLineFeeds(const char *pInput, unsigned int numberOfInputBytes)
+{
+    unsigned int numberOfLineFeeds = 0;
+    unsigned int i = 0;
+#ifdef CCLIP_USE_SSE2
+    const __m128i lineFeed = _mm_set1_epi8('\n');
+
+    while (i + 16 <= numberOfInputBytes)
+    {
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(pInput + i)), lineFeed));
+
+        if (mask != 0)
+            numberOfLineFeeds += CountBits16(mask);
+        i += 16;
+    }
+#endif /* #ifdef CCLIP_USE_SSE2 */
+
+    for (; i < numberOfInputBytes; i++)
+    {
+        if (pInput[i] == '\n')
+            numberOfLineFeeds++;
+    }
+
+    return numberOfLineFeeds;
+}
+
+/* DecodeUtf16String()
+ *
+ * Copy UTF16 characters (little or big endian, not zero terminated) to wide
+ * characters. When yCrlf is set every line feed that does not follow a
+ * carriage return is converted to CR LF. When the output pointer is NULL
+ * nothing is written (for size calculation).
+ *
+ * Returns the number of wide characters (written or required).
+ */
+unsigned int DecodeUtf16String(const char *pInput,
+                               unsigned int numberOfInputCharacters,
+                               unsigned int yBigEndian, unsigned int yCrlf,
+                               wchar_t *pOutput)
+{
+    const unsigned char *pBytes = (const unsigned char *)pInput;
+    unsigned int numberOfOutputCharacters = 0;
+    wchar_t previousCharacter = 0;
+    unsigned int i;
+
+    if (!yBigEndian && !yCrlf)
+    {
+        if (pOutput != NULL)
+            memcpy(pOutput, pInput, numberOfInputCharacters * sizeof(wchar_t));
+        return numberOfInputCharacters;
+    }
+
+    for (i = 0; i < numberOfInputCharacters; i++)
+    {
+        wchar_t character;
+
+        if (yBigEndian)
+            character = (wchar_t)((pBytes[2 * i] << 8) | pBytes[2 * i + 1]);
+        else
+            character = (wchar_t)(pBytes[2 * i] | (pBytes[2 * i + 1] << 8));
+
+        if (yCrlf && character == L'\n' && previousCharacter != L'\r')
+        {
+            if (pOutput != NULL)
+                pOutput[numberOfOutputCharacters] = L'\r';
+            numberOfOutputCharacters++;
+        }
+        if (pOutput != NULL)
+            pOutput[numberOfOutputCharacters] = character;
+        numberOfOutputCharacters++;
+        previousCharacter = character;
+    }
+
+    return numberOfOutputCharacters;
+}
+
+/* CountNulBytes()
+ *
+ * Count the NUL bytes at even and at odd offsets of a buffer, 16 bytes at a
+ * time when SSE2 is available.
+ */
+void CountNulBytes(const unsigned char *pInput, unsigned int numberOfInputBytes,
+                   unsigned int *pEvenNulBytes, unsigned int *pOddNulBytes)
+{
+    unsigned int evenNulBytes = 0;
+    unsigned int oddNulBytes = 0;
+    unsigned int i = 0;
+#ifdef CCLIP_USE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+
+    while (i + 16 <= numberOfInputBytes)
+    {
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(pInput + i)), zero));
+
+        if (mask != 0)
+        {
+            evenNulBytes += CountBits16(mask & 0x5555);
+            oddNulBytes += CountBits16(mask & 0xAAAA);
+        }
+        i += 16;
+    }
+#endif /* #ifdef CCLIP_USE_SSE2 */
+
+    for (; i < numberOfInputBytes; i++)
+    {
+        if (pInput[i] == 0)
+        {
+            if (i & 1)
+                oddNulBytes++;
+            else
+                evenNulBytes++;
+        }
+    }
+
+    *pEvenNulBytes = evenNulBytes;
+    *pOddNulBytes = oddNulBytes;
+}
+
+/* CheckUtf8()
+ *
+ * Validate UTF8 data, skipping runs of ASCII characters 16 bytes at a time
+ * when SSE2 is available. Overlong encodings, surrogates and code points
+ * above U+10FFFF are invalid. A sequence that is cut off at the end of the
+ * data is accepted when the data is only the start of the input.
+ *
+ * Returns 0 if the data is no valid UTF8, 1 if it is plain ASCII or 2 if it
+ * is valid UTF8 with multibyte sequences.
+ */
+int CheckUtf8(const unsigned char *pInput, unsigned int numberOfInputBytes,
+              unsigned int yTruncated)
+{
+    unsigned int yMultibyte = 0;
+    unsigned int i = 0;
+
+    while (i < numberOfInputBytes)
+    {
+        unsigned int c = pInput[i];
+        unsigned int sequenceBytes;
+        unsigned int minSecond = 0x80;
+        unsigned int maxSecond = 0xBF;
+        unsigned int j;
+
+#ifdef CCLIP_USE_SSE2
+        if (c < 0x80 && i + 16 <= numberOfInputBytes &&
+            _mm_movemask_epi8(_mm_loadu_si128(
+                (const __m128i *)(pInput + i))) == 0)
+        {
+            i += 16;
+            continue;
+        }
+#endif /* #ifdef CCLIP_USE_SSE2 */
+
+        if (c < 0x80)
+        {
+            i++;
+            continue;
+        }
+        else if (c >= 0xC2 && c <= 0xDF)
+        {
+            sequenceBytes = 2;
+        }
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            sequenceBytes = 3;
+            if (c == 0xE0)
+                minSecond = 0xA0;
+            else if (c == 0xED)
+                maxSecond = 0x9F;
+        }
+        else if (c >= 0xF0 && c <= 0xF4)
+        {
+            sequenceBytes = 4;
+            if (c == 0xF0)
+                minSecond = 0x90;
+            else if (c == 0xF4)
+                maxSecond = 0x8F;
+        }
+        else
+        {
+            return 0;
+        }
+
+        for (j = 1; j < sequenceBytes; j++)
+        {
+            if (i + j >= numberOfInputBytes)
+                return (yTruncated ? 2 : 0);
+            c = pInput[i + j];
+            if (j == 1 ? (c < minSecond || c > maxSecond) :
+                (c < 0x80 || c > 0xBF))
+            {
+                return 0;
+            }
+        }
+        i += sequenceBytes;
+        yMultibyte = 1;
+    }
+
+    return (yMultibyte ? 2 : 1);
+}
+
+/* DetectInputCodepage()
+ *
+ * Guess the codepage of input data from its first CODEPAGE_DETECTION_BYTES
+ * bytes: a byte order mark (UTF8, UTF16LE or UTF16BE), the NUL bytes of
+ * UTF16 text with mostly ASCII characters or valid UTF8 with multibyte
+ * sequences. Plain ASCII and anything else results in the given default
+ * codepage. Stores the size of the byte order mark (which the caller must
+ * skip, zero if there is none) in an output variable.
+ *
+ * Returns the detected codepage.
+ */
+unsigned int DetectInputCodepage(const char *pInputBuffer,
+                                 unsigned int numberOfInputBytes,
+                                 unsigned int defaultCodepage,
+                                 unsigned int *pBomSizeBytes)
+{
+    const unsigned char *pInput = (const unsigned char *)pInputBuffer;
+    unsigned int numberOfCheckedBytes = numberOfInputBytes;
+    unsigned int evenNulBytes;
+    unsigned int oddNulBytes;
+
+    *pBomSizeBytes = 0;
+    if (numberOfInputBytes >= 3 && pInput[0] == 0xEF && pInput[1] == 0xBB &&
+        pInput[2] == 0xBF)
+    {
+        *pBomSizeBytes = 3;
+        return CP_UTF8;
+    }
+    if (numberOfInputBytes >= 2 && pInput[0] == 0xFF && pInput[1] == 0xFE)
+    {
+        *pBomSizeBytes = 2;
+        return CODEPAGE_UTF16LE;
+    }
+    if (numberOfInputBytes >= 2 && pInput[0] == 0xFE && pInput[1] == 0xFF)
+    {
+        *pBomSizeBytes = 2;
+        return CODEPAGE_UTF16BE;
+    }
+
+    if (numberOfCheckedBytes > CODEPAGE_DETECTION_BYTES)
+        numberOfCheckedBytes = CODEPAGE_DETECTION_BYTES;
+
+    /* text in an 8 bit codepage has no NUL bytes, UTF16 with mostly ASCII
+       characters has them in every other byte */
+    CountNulBytes(pInput, numberOfCheckedBytes, &evenNulBytes, &oddNulBytes);
+    if (oddNulBytes > numberOfCheckedBytes / 8 &&
+        evenNulBytes < oddNulBytes / 8)
+    {
+        return CODEPAGE_UTF16LE;
+    }
+    if (evenNulBytes > numberOfCheckedBytes / 8 &&
+        oddNulBytes < evenNulBytes / 8)
+    {
+        return CODEPAGE_UTF16BE;
+    }
+
+    if (CheckUtf8(pInput, numberOfCheckedBytes,
+        numberOfCheckedBytes < numberOfInputBytes) == 2)
+    {
+        return CP_UTF8;
+    }
+
+    return defaultCodepage;
+}
+
+/* ReserveBuffer()
+ *
+ * Make sure that a retained buffer (a buffer pointer and its capacity, both
+ * may be zero initially) in an arena holds at least a given number of bytes.
+ * A buffer that is too small is grown with ArenaRealloc() to at least double
+ * its capacity, so that repeated use with similar sizes stops allocating
+ * after warm-up.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description and the retained buffer is left unchanged.
+ */
+int ReserveBuffer(Arena *pArena, void **ppBuffer,
+                  unsigned int *pBufferCapacityBytes, unsigned int sizeBytes,
+                  ErrBlock *pEb)
+{
+    void *pNewBuffer;
+    unsigned int newCapacityBytes;
+
+    if (*ppBuffer != NULL && *pBufferCapacityBytes >= sizeBytes)
+        return 0;
+
+    newCapacityBytes = *pBufferCapacityBytes * 2;
+    if (newCapacityBytes < sizeBytes)
+        newCapacityBytes = sizeBytes;
+    if (newCapacityBytes == 0)
+        newCapacityBytes = 1;
+
+    pNewBuffer = ArenaRealloc(pArena, *ppBuffer, *pBufferCapacityBytes,
+        newCapacityBytes);
+    if (pNewBuffer == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate buffer of %u bytes", newCapacityBytes);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    *ppBuffer = pNewBuffer;
+    *pBufferCapacityBytes = newCapacityBytes;
+    return 0;
+}
+
+/* size of the blocks read while searching a line range in a file on disk */
+#define LINE_SCAN_BLOCK_BYTES   65536
+
+/* ReadBytesFromFile()
+ *
+ * Read up to a given number of bytes from a file handle, calling ReadFile()
+ * until all bytes are read or the end of the input (or of a pipe) is
+ * reached. Stores the number of read bytes in an output variable.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int ReadBytesFromFile(HANDLE fileHandle, void *pBuffer, unsigned int sizeBytes,
+                      unsigned int *pReadBytes, ErrBlock *pEb)
+{
+    unsigned int totalReadBytes = 0;
+
+    while (totalReadBytes < sizeBytes)
+    {
+        DWORD readBytes;
+
+        if (!ReadFile(fileHandle, (char *)pBuffer + totalReadBytes,
+            sizeBytes - totalReadBytes, &readBytes, NULL))
+        {
+            if (GetLastError() == ERROR_BROKEN_PIPE)
+                break;
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "ReadFile() failed, GetLastError() = 0x%X",
+                    GetLastError());
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 1;
+            }
+            return -1;
+        }
+        if (readBytes == 0)
+            break;
+        totalReadBytes += readBytes;
+    }
+
+    *pReadBytes = totalReadBytes;
+    return 0;
+}
+
+/* ReadFileBlock()
+ *
+ * Read a given number of bytes at a given offset of a file on disk.
+ *
+ * Returns zero on success or -1 in case of an error (also when the file
+ * ends before the block). In case of an error and when the error block
+ * pointer is not NULL the error block is filled with an error description.
+ */
+int ReadFileBlock(HANDLE fileHandle, LONGLONG offset, void *pBuffer,
+                  unsigned int sizeBytes, ErrBlock *pEb)
+{
+    LARGE_INTEGER position;
+    unsigned int readBytes;
+
+    position.QuadPart = offset;
+    if (!SetFilePointerEx(fileHandle, position, NULL, FILE_BEGIN))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "SetFilePointerEx() failed, GetLastError() = 0x%X",
+                GetLastError());
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    if (ReadBytesFromFile(fileHandle, pBuffer, sizeBytes, &readBytes, pEb))
+        return -1;
+    if (readBytes != sizeBytes)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "File ended after %u of %u bytes of a block", readBytes,
+                sizeBytes);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/* FindLineRangeInFile()
+ *
+ * Find the byte range of a line selection in a file on disk of a given size
+ * without reading more than needed: blocks are read forward from the start
+ * for a line range and backward from the end for the last lines. The line
+ * feeds of a block are counted with CountLineFeeds() and only located byte
+ * by byte in the block with a range boundary. The block buffer is taken
+ * from an arena. Stores the start and end offsets of the range in output
+ * variables.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int FindLineRangeInFile(HANDLE fileHandle, LONGLONG fileSizeBytes,
+                        const LineSelection *pLineSelection, Arena *pArena,
+                        LONGLONG *pRangeStart, LONGLONG *pRangeEnd,
+                        ErrBlock *pEb)
+{
+    char *pBlock;
+    LONGLONG blockStart;
+    LONGLONG rangeStart;
+    LONGLONG rangeEnd = fileSizeBytes;
+    unsigned int blockSizeBytes;
+    unsigned int numberOfLineFeeds = 0;
+    unsigned int i;
+
+    pBlock = ArenaAlloc(pArena, LINE_SCAN_BLOCK_BYTES);
+    if (pBlock == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate memory for line scan buffer");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    if (pLineSelection->yTail)
+    {
+        /* backward from the end: the range starts after the line feed
+           before the last lines, a line feed at the very end only ends the
+           last line */
+        unsigned int remainingLineFeeds = pLineSelection->numberOfTailLines;
+
+        rangeStart = (remainingLineFeeds == 0 ? fileSizeBytes : 0);
+        blockStart = fileSizeBytes;
+        while (blockStart > 0 && remainingLineFeeds != 0)
+        {
+            unsigned int scanSizeBytes;
+
+            blockSizeBytes = (blockStart > LINE_SCAN_BLOCK_BYTES ?
+                LINE_SCAN_BLOCK_BYTES : (unsigned int)blockStart);
+            blockStart -= blockSizeBytes;
+            if (ReadFileBlock(fileHandle, blockStart, pBlock, blockSizeBytes,
+                pEb))
+            {
+                return -1;
+            }
+
+            scanSizeBytes = blockSizeBytes;
+            if (blockStart + blockSizeBytes == fileSizeBytes &&
+                pBlock[scanSizeBytes - 1] == '\n')
+            {
+                scanSizeBytes--;
+            }
+            numberOfLineFeeds = CountLineFeeds(pBlock, scanSizeBytes);
+            if (numberOfLineFeeds < remainingLineFeeds)
+            {
+                remainingLineFeeds -= numberOfLineFeeds;
+                continue;
+            }
+
+            for (i = scanSizeBytes; i > 0; i--)
+            {
+                if (pBlock[i - 1] == '\n' && --remainingLineFeeds == 0)
+                    break;
+            }
+            rangeStart = blockStart + i;
+        }
+    }
+    else
+    {
+        /* forward from the start: the range starts after line feed number
+           firstLine - 1 and ends after line feed number lastLine */
+        unsigned int yStartFound = (pLineSelection->firstLine <= 1);
+        unsigned int yEndFound = 0;
+
+        rangeStart = (yStartFound ? 0 : fileSizeBytes);
+        for (blockStart = 0; blockStart < fileSizeBytes && !yEndFound &&
+            !(yStartFound && pLineSelection->lastLine == 0);
+            blockStart += blockSizeBytes)
+        {
+            unsigned int targetLineFeeds = (yStartFound ?
+                pLineSelection->lastLine : pLineSelection->firstLine - 1);
+
+            blockSizeBytes = (fileSizeBytes - blockStart >
+                LINE_SCAN_BLOCK_BYTES ? LINE_SCAN_BLOCK_BYTES :
+                (unsigned int)(fileSizeBytes - blockStart));
+            if (ReadFileBlock(fileHandle, blockStart, pBlock, blockSizeBytes,
+                pEb))
+            {
+                return -1;
+            }
+
+            i = CountLineFeeds(pBlock, blockSizeBytes);
+            if (numberOfLineFeeds + i < targetLineFeeds)
+            {
+                numberOfLineFeeds += i;
+                continue;
+            }
+
+            for (i = 0; i < blockSizeBytes && !yEndFound; i++)
+            {
+                if (pBlock[i] != '\n')
+                    continue;
+                numberOfLineFeeds++;
+                if (!yStartFound &&
+                    numberOfLineFeeds == pLineSelection->firstLine - 1)
+                {
+                    rangeStart = blockStart + i + 1;
+                    yStartFound = 1;
+                }
+                if (yStartFound &&
+                    numberOfLineFeeds == pLineSelection->lastLine)
+                {
+                    rangeEnd = blockStart + i + 1;
+                    yEndFound = 1;
+                }
+            }
+        }
+    }
+
+    *pRangeStart = rangeStart;
+    *pRangeEnd = rangeEnd;
+    return 0;
+}
+
+/* ReadStreamLinesToNewBuffer()
+ *
+ * Allocate a buffer and fill it with the selected lines of a stream (a pipe
+ * or console), read in steps of bufferSizeStep bytes. The line feeds of
+ * every step are indexed while reading: for a line range they are counted
+ * with CountLineFeeds() until the range starts and ends (the rest of the
+ * stream is not read), for the last lines the positions of the last line
+ * feeds are kept in a ring with memchr(). Bytes before the selection are
+ * dropped while reading, so the buffer stays proportional to the selection.
+ * The buffer and the ring are taken from an arena. Stores the address of the
+ * allocated buffer (released with the arena) and the size of the selection
+ * in output variables.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. When an error occurrs the values of the output
+ * pointers are undefined.
+ */
+int ReadStreamLinesToNewBuffer(HANDLE fileHandle, unsigned int bufferSizeStep,
+                               const LineSelection *pLineSelection,
+                               Arena *pArena, void **ppAllocatedBuffer,
+                               unsigned int *pSelectionSizeBytes,
+                               ErrBlock *pEb)
+{
+    char *pBuffer = NULL;
+    unsigned int bufferCapacityBytes = 0;
+    unsigned int bufferSizeBytes = 0;
+    LONGLONG bufferOffset = 0;      /* stream offset of the buffer start */
+    LONGLONG *pLineFeedRing = NULL;
+    unsigned int ringSize = 0;
+    unsigned int numberOfLineFeeds = 0;
+    unsigned int yStartFound = (pLineSelection->firstLine <= 1);
+    unsigned int yEndFound = 0;
+    LONGLONG rangeStart = 0;
+    unsigned int selectionStart;
+
+    if (pLineSelection->yTail)
+    {
+        /* positions of the last numberOfTailLines + 1 line feeds, the
+           selection starts after the first of them when the input ends
+           with a line feed and after the second one otherwise */
+        ringSize = pLineSelection->numberOfTailLines + 1;
+        if (pLineSelection->numberOfTailLines < 0x10000000)
+        {
+            pLineFeedRing = ArenaAlloc(pArena,
+                ringSize * sizeof(LONGLONG));
+        }
+        if (pLineFeedRing == NULL)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "Could not allocate line index for %u lines",
+                    pLineSelection->numberOfTailLines);
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 1;
+            }
+            return -1;
+        }
+    }
+
+    while (!yEndFound)
+    {
+        unsigned int readBytes;
+        unsigned int chunkStart = bufferSizeBytes;
+        unsigned int keepStart = 0;
+        unsigned int i;
+
+        if (ReserveBuffer(pArena, (void **)&pBuffer, &bufferCapacityBytes,
+            bufferSizeBytes + bufferSizeStep + sizeof(wchar_t), pEb) ||
+            ReadBytesFromFile(fileHandle, pBuffer + bufferSizeBytes,
+            bufferSizeStep, &readBytes, pEb))
+        {
+            return -1;
+        }
+        if (readBytes == 0)
+            break;
+        bufferSizeBytes += readBytes;
+
+        if (pLineSelection->yTail)
+        {
+            const char *pLineFeed = pBuffer + chunkStart;
+
+            while ((pLineFeed = memchr(pLineFeed, '\n',
+                pBuffer + bufferSizeBytes - pLineFeed)) != NULL)
+            {
+                numberOfLineFeeds++;
+                pLineFeedRing[numberOfLineFeeds % ringSize] =
+                    bufferOffset + (pLineFeed - pBuffer);
+                pLineFeed++;
+            }
+
+            /* everything up to the line feed before the earliest possible
+               start of the selection can be dropped */
+            if (numberOfLineFeeds > pLineSelection->numberOfTailLines)
+            {
+                keepStart = (unsigned int)(pLineFeedRing[(numberOfLineFeeds -
+                    pLineSelection->numberOfTailLines) % ringSize] + 1 -
+                    bufferOffset);
+            }
+        }
+        else
+        {
+            if (!yStartFound || pLineSelection->lastLine != 0)
+            {
+                unsigned int targetLineFeeds = (yStartFound ?
+                    pLineSelection->lastLine : pLineSelection->firstLine - 1);
+
+                i = CountLineFeeds(pBuffer + chunkStart, readBytes);
+                if (numberOfLineFeeds + i < targetLineFeeds)
+                    numberOfLineFeeds += i;
+                else
+                {
+                    for (i = chunkStart; i < bufferSizeBytes; i++)
+                    {
+                        if (pBuffer[i] != '\n')
+                            continue;
+                        numberOfLineFeeds++;
+                        if (!yStartFound && numberOfLineFeeds ==
+                            pLineSelection->firstLine - 1)
+                        {
+                            rangeStart = bufferOffset + i + 1;
+                            yStartFound = 1;
+                        }
+                        if (yStartFound &&
+                            numberOfLineFeeds == pLineSelection->lastLine)
+                        {
+                            bufferSizeBytes = i + 1;
+                            yEndFound = 1;
+                            break;
+                        }
+                    }
+                }
+            }
+            keepStart = (yStartFound ?
+                (unsigned int)(rangeStart - bufferOffset) : bufferSizeBytes);
+        }
+
+        /* drop the bytes before the selection once they fill half of the
+           buffer */
+        if (keepStart != 0 && keepStart >= bufferSizeBytes - keepStart)
+        {
+            memmove(pBuffer, pBuffer + keepStart, bufferSizeBytes - keepStart);
+            bufferSizeBytes -= keepStart;
+            bufferOffset += keepStart;
+        }
+    }
+
+    /* start of the selection in the buffer */
+    if (pLineSelection->yTail)
+    {
+        /* number of lines: a last line without line feed counts as well */
+        unsigned int lineFeedNumber = numberOfLineFeeds;
+
+        if (bufferSizeBytes != 0 && pBuffer[bufferSizeBytes - 1] != '\n')
+            lineFeedNumber++;
+        if (lineFeedNumber > pLineSelection->numberOfTailLines)
+        {
+            lineFeedNumber -= pLineSelection->numberOfTailLines;
+            selectionStart = (unsigned int)(pLineFeedRing[lineFeedNumber %
+                ringSize] + 1 - bufferOffset);
+        }
+        else
+        {
+            selectionStart = 0;
+        }
+    }
+    else
+    {
+        selectionStart = (yStartFound ?
+            (unsigned int)(rangeStart - bufferOffset) : bufferSizeBytes);
+    }
+    memmove(pBuffer, pBuffer + selectionStart,
+        bufferSizeBytes - selectionStart);
+
+    /* success */
+    *ppAllocatedBuffer = pBuffer;
+    *pSelectionSizeBytes = bufferSizeBytes - selectionStart;
+    return 0;
+}
+
+/* ReadFileLinesToNewBuffer()
+ *
+ * Allocate a buffer and fill it with the lines of a given file handle that
+ * are selected by a line range or a number of last lines, or with all data
+ * when the selection pointer is NULL. Lines end with a line feed byte, so
+ * that only codepages in which every line feed byte is a line feed are
+ * supported. Files on disk are searched with FindLineRangeInFile() and only
+ * the selected bytes are read, other input is read with
+ * ReadStreamLinesToNewBuffer(). The buffer is allocated from an arena.
+ * Stores the address of the allocated buffer (released with the arena) and
+ * the size of the selection in output variables. Like with
+ * ReadFileToNewBuffer() the buffer has at least sizeof(wchar_t) spare bytes
+ * behind the selection.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. When an error occurrs the values of the output
+ * pointers are undefined.
+ */
+int ReadFileLinesToNewBuffer(HANDLE fileHandle, unsigned int bufferSizeStep,
+                             const LineSelection *pLineSelection,
+                             Arena *pArena, void **ppAllocatedBuffer,
+                             unsigned int *pSelectionSizeBytes,
+                             ErrBlock *pEb)
+{
+    LARGE_INTEGER fileSize;
+    LONGLONG rangeStart;
+    LONGLONG rangeEnd;
+    char *pBuffer;
+    ErrBlock eb;
+
+    if (pLineSelection == NULL)
+    {
+        return ReadFileToNewBuffer(fileHandle, bufferSizeStep, pArena,
+            ppAllocatedBuffer, pSelectionSizeBytes, pEb);
+    }
+
+    if (GetFileType(fileHandle) != FILE_TYPE_DISK ||
+        !GetFileSizeEx(fileHandle, &fileSize))
+    {
+        return ReadStreamLinesToNewBuffer(fileHandle, bufferSizeStep,
+            pLineSelection, pArena, ppAllocatedBuffer, pSelectionSizeBytes,
+            pEb);
+    }
+
+    if (FindLineRangeInFile(fileHandle, fileSize.QuadPart, pLineSelection,
+        pArena, &rangeStart, &rangeEnd, &eb))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Searching the selected lines failed (%s)",
+                eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+    if (rangeEnd - rangeStart > 0x7FFFFFFF)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Selected lines exceed 2 GiB");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        return -1;
+    }
+
+    /* spare bytes like ReadFileToNewBuffer(), which also gives an empty
+       selection a buffer */
+    pBuffer = ArenaAlloc(pArena,
+        (size_t)(rangeEnd - rangeStart) + sizeof(wchar_t));
+    if (pBuffer == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate memory for input buffer");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 3;
+        }
+        return -1;
+    }
+    if (ReadFileBlock(fileHandle, rangeStart, pBuffer,
+        (unsigned int)(rangeEnd - rangeStart), &eb))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Reading the selected lines failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 4;
+        }
+        return -1;
+    }
+
+    /* success */
+    *ppAllocatedBuffer = pBuffer;
+    *pSelectionSizeBytes = (unsigned int)(rangeEnd - rangeStart);
+    return 0;
+}
+
+/* one atom of a compiled regular expression with its quantifier ('*', '?'
+   or zero; an atom with '+' is compiled as the atom followed by the atom
+   with '*') */
+typedef struct RegexAtom_
+{
+    const char *pAtom;
+    const char *pAtomEnd;
+    char quantifier;
+} RegexAtom;
+
+/* line filter compiled for the codepage of an input: the pattern bytes,
+   the longest literal that every match contains and the atoms with the
+   state lists of the matching automaton (see MatchRegex()) */
+typedef struct CompiledLineFilter_
+{
+    char *pPattern;
+    unsigned int patternSizeBytes;
+    const char *pLiteral;
+    unsigned int literalSizeBytes;
+    int yUtf8;
+    int yAnchoredStart;
+    int yAnchoredEnd;
+    RegexAtom *pAtoms;
+    unsigned int numberOfAtoms;
+    unsigned int *pStateMarks;
+    unsigned int *pStateLists[2];
+    unsigned int stateGeneration;
+} CompiledLineFilter;
+
+/* DecodeRegexCharacter()
+ *
+ * Decode the character at the start of a pattern or text. Without UTF8
+ * every byte is a character; with UTF8 a valid sequence of up to four
+ * bytes is one character and every byte of an invalid sequence is a
+ * character of its own (a low surrogate code point, like Python's
+ * "surrogateescape", so that it never equals a valid character). Stores
+ * the code point of the character in an output variable.
+ *
+ * Returns the size of the character in bytes.
+ */
+unsigned int DecodeRegexCharacter(const char *pText, const char *pTextEnd,
+                                  int yUtf8, unsigned int *pCodePoint)
+{
+    const unsigned char *p = (const unsigned char *)pText;
+    unsigned int codePoint;
+    unsigned int size;
+    unsigned int i;
+
+    if (!yUtf8 || p[0] < 0x80)
+    {
+        *pCodePoint = p[0];
+        return 1;
+    }
+
+    if (p[0] >= 0xc2 && p[0] <= 0xdf)
+    {
+        size = 2;
+        codePoint = p[0] & 0x1f;
+    }
+    else if ((p[0] & 0xf0) == 0xe0)
+    {
+        size = 3;
+        codePoint = p[0] & 0x0f;
+    }
+    else if (p[0] >= 0xf0 && p[0] <= 0xf4)
+    {
+        size = 4;
+        codePoint = p[0] & 0x07;
+    }
+    else
+    {
+        size = 0;
+        codePoint = 0;
+    }
+    if (size > (unsigned int)(pTextEnd - pText))
+        size = 0;
+    for (i = 1; i < size; i++)
+    {
+        if ((p[i] & 0xc0) != 0x80)
+        {
+            size = 0;
+            break;
+        }
+        codePoint = (codePoint << 6) | (p[i] & 0x3f);
+    }
+    /* overlong sequences, surrogates and code points beyond U+10FFFF */
+    if ((size == 3 && (codePoint < 0x800 ||
+        (codePoint >= 0xd800 && codePoint <= 0xdfff))) ||
+        (size == 4 && (codePoint < 0x10000 || codePoint > 0x10ffff)))
+    {
+        size = 0;
+    }
+
+    if (size == 0)
+    {
+        *pCodePoint = 0xdc00 | p[0];
+        return 1;
+    }
+    *pCodePoint = codePoint;
+    return size;
+}
+
+/* RegexAtomEnd()
+ *
+ * Find the end of the regular expression atom at the start of a pattern:
+ * one character, an escape sequence or a bracket expression.
+ *
+ * Returns a pointer behind the atom or NULL if the atom is incomplete.
+ */
+const char *RegexAtomEnd(const char *pAtom, const char *pPatternEnd,
+                         int yUtf8)
+{
+    const char *p;
+    unsigned int codePoint;
+
+    if (*pAtom == '\\')
+    {
+        return (pAtom + 1 < pPatternEnd ? pAtom + 1 +
+            DecodeRegexCharacter(pAtom + 1, pPatternEnd, yUtf8, &codePoint) :
+            NULL);
+    }
+    if (*pAtom != '[')
+        return pAtom + DecodeRegexCharacter(pAtom, pPatternEnd, yUtf8,
+            &codePoint);
+
+    /* a ']' right after "[" or "[^" belongs to the bracket expression (the
+       bytes of UTF8 sequences are never '\\' or ']') */
+    p = pAtom + 1;
+    if (p < pPatternEnd && *p == '^')
+        p++;
+    if (p < pPatternEnd && *p == ']')
+        p++;
+    for (; p < pPatternEnd; p++)
+    {
+        if (*p == '\\')
+            p++;
+        else if (*p == ']')
+            return p + 1;
+    }
+    return NULL;
+}
+
+/* RegexClassMatches()
+ *
+ * Test a character against the class of an escape sequence: \d for digits,
+ * \w for letters, digits and underscore and \s for white space (all of them
+ * ASCII only). Other escaped characters stand for themselves.
+ *
+ * Returns nonzero if the character matches.
+ */
+int RegexClassMatches(unsigned int escapedCharacter, unsigned int c)
+{
+    switch (escapedCharacter)
+    {
+    case 'd':
+        return (c >= '0' && c <= '9');
+    case 'w':
+        return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '_');
+    case 's':
+        return (c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+            c == '\f' || c == '\v');
+    default:
+        return (c == escapedCharacter);
+    }
+}
+
+/* RegexAtomMatches()
+ *
+ * Test a character (see DecodeRegexCharacter()) against a regular
+ * expression atom (see RegexAtomEnd()).
+ *
+ * Returns nonzero if the character matches.
+ */
+int RegexAtomMatches(const char *pAtom, const char *pAtomEnd, int yUtf8,
+                     unsigned int c)
+{
+    const char *p;
+    const char *pMembersEnd = pAtomEnd - 1;
+    unsigned int first;
+    unsigned int last;
+    int yNegated;
+    int yMatch = 0;
+
+    if (*pAtom == '.')
+        return 1;
+    if (*pAtom == '\\')
+    {
+        DecodeRegexCharacter(pAtom + 1, pAtomEnd, yUtf8, &first);
+        return RegexClassMatches(first, c);
+    }
+    if (*pAtom != '[')
+    {
+        DecodeRegexCharacter(pAtom, pAtomEnd, yUtf8, &first);
+        return (c == first);
+    }
+
+    p = pAtom + 1;
+    yNegated = (*p == '^');
+    if (yNegated)
+        p++;
+    do
+    {
+        if (*p == '\\')
+        {
+            p++;
+            p += DecodeRegexCharacter(p, pMembersEnd, yUtf8, &first);
+            if (RegexClassMatches(first, c))
+                yMatch = 1;
+            continue;
+        }
+        p += DecodeRegexCharacter(p, pMembersEnd, yUtf8, &first);
+        if (*p == '-' && p + 1 < pMembersEnd)
+        {
+            p++;
+            p += DecodeRegexCharacter(p, pMembersEnd, yUtf8, &last);
+            if (c >= first && c <= last)
+                yMatch = 1;
+        }
+        else if (c == first)
+        {
+            yMatch = 1;
+        }
+    } while (p < pMembersEnd);
+
+    return (yMatch != yNegated);
+}
+
+/* AddRegexState()
+ *
+ * Add a state of the matching automaton (the index of the next atom to
+ * match, the number of atoms for a complete match) to a state list, with
+ * the states behind it that atoms with the quantifiers * and ? can skip.
+ * States already marked with the generation of the list are not added
+ * again, which bounds a list to one entry per state.
+ */
+void AddRegexState(CompiledLineFilter *pFilter, unsigned int *pList,
+                   unsigned int *pListSize, unsigned int state)
+{
+    while (pFilter->pStateMarks[state] != pFilter->stateGeneration)
+    {
+        pFilter->pStateMarks[state] = pFilter->stateGeneration;
+        pList[(*pListSize)++] = state;
+        if (state == pFilter->numberOfAtoms ||
+            pFilter->pAtoms[state].quantifier == 0)
+        {
+            break;
+        }
+        state++;
+    }
+}
+
+/* NextRegexGeneration()
+ *
+ * Start a new state list generation (see AddRegexState()), clearing the
+ * marks when the generation counter wraps around.
+ */
+void NextRegexGeneration(CompiledLineFilter *pFilter)
+{
+    pFilter->stateGeneration++;
+    if (pFilter->stateGeneration == 0)
+    {
+        memset(pFilter->pStateMarks, 0,
+            (pFilter->numberOfAtoms + 1) * sizeof(unsigned int));
+        pFilter->stateGeneration = 1;
+    }
+}
+
+/* MatchRegex()
+ *
+ * Search the regular expression of a compiled line filter in a line (not
+ * zero terminated, without line end). A leading ^ anchors the match at the
+ * start and a trailing $ at the end of the line. The atoms are simulated
+ * as a nondeterministic automaton that follows all alternatives of the
+ * quantifiers at once, one character of the line at a time, so the time
+ * is linear in the line length for every pattern (there is no
+ * backtracking).
+ *
+ * Returns nonzero if the line contains a match.
+ */
+int MatchRegex(CompiledLineFilter *pFilter, const char *pLine,
+               unsigned int lineSizeBytes)
+{
+    const char *pLineEnd = pLine + lineSizeBytes;
+    const char *p = pLine;
+    unsigned int *pCurrent = pFilter->pStateLists[0];
+    unsigned int *pNext = pFilter->pStateLists[1];
+    unsigned int *pSwap;
+    unsigned int currentSize = 0;
+    unsigned int nextSize;
+    unsigned int c;
+    unsigned int i;
+
+    NextRegexGeneration(pFilter);
+    AddRegexState(pFilter, pCurrent, &currentSize, 0);
+
+    for (;;)
+    {
+        /* the complete match state is marked with the current generation */
+        if (pFilter->pStateMarks[pFilter->numberOfAtoms] ==
+            pFilter->stateGeneration &&
+            (!pFilter->yAnchoredEnd || p == pLineEnd))
+        {
+            return 1;
+        }
+        if (p == pLineEnd || (currentSize == 0 && pFilter->yAnchoredStart))
+            return 0;
+
+        p += DecodeRegexCharacter(p, pLineEnd, pFilter->yUtf8, &c);
+        NextRegexGeneration(pFilter);
+        nextSize = 0;
+        for (i = 0; i < currentSize; i++)
+        {
+            const RegexAtom *pAtom;
+
+            if (pCurrent[i] == pFilter->numberOfAtoms)
+                continue;
+            pAtom = pFilter->pAtoms + pCurrent[i];
+            if (RegexAtomMatches(pAtom->pAtom, pAtom->pAtomEnd,
+                pFilter->yUtf8, c))
+            {
+                AddRegexState(pFilter, pNext, &nextSize,
+                    pAtom->quantifier == '*' ? pCurrent[i] : pCurrent[i] + 1);
+            }
+        }
+        /* without ^ a match can also start behind this character */
+        if (!pFilter->yAnchoredStart)
+            AddRegexState(pFilter, pNext, &nextSize, 0);
+
+        pSwap = pCurrent;
+        pCurrent = pNext;
+        pNext = pSwap;
+        currentSize = nextSize;
+    }
+}
+
+/* FindLiteral()
+ *
+ * Search a byte string in a text. With SSE2 the first and the last byte of
+ * the string are compared at 16 positions at once and only the positions
+ * where both match are compared completely.
+ *
+ * Returns a pointer to the first occurrence or NULL if there is none.
+ */
+const char *FindLiteral(const char *pText, unsigned int textSizeBytes,
+                        const char *pLiteral, unsigned int literalSizeBytes)
+{
+    unsigned int i = 0;
+
+    if (literalSizeBytes == 0)
+        return pText;
+    if (literalSizeBytes > textSizeBytes)
+        return NULL;
+
+#ifdef CCLIP_USE_SSE2
+    {
+        const __m128i first = _mm_set1_epi8(pLiteral[0]);
+        const __m128i last = _mm_set1_epi8(pLiteral[literalSizeBytes - 1]);
+
+        while (i + 16 + literalSizeBytes - 1 <= textSizeBytes)
+        {
+            unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_and_si128(
+                _mm_cmpeq_epi8(_mm_loadu_si128(
+                    (const __m128i *)(pText + i)), first),
+                _mm_cmpeq_epi8(_mm_loadu_si128(
+                    (const __m128i *)(pText + i + literalSizeBytes - 1)),
+                    last)));
+
+            while (mask != 0)
+            {
+                unsigned int bit = 0;
+
+                while (!(mask & (1u << bit)))
+                    bit++;
+                if (memcmp(pText + i + bit, pLiteral, literalSizeBytes) == 0)
+                    return pText + i + bit;
+                mask &= mask - 1;
+            }
+            i += 16;
+        }
+    }
+#endif /* #ifdef CCLIP_USE_SSE2 */
+
+    for (; i + literalSizeBytes <= textSizeBytes; i++)
+    {
+        if (pText[i] == pLiteral[0] &&
+            memcmp(pText + i, pLiteral, literalSizeBytes) == 0)
+        {
+            return pText + i;
+        }
+    }
+    return NULL;
+}
+
+/* CompileLineFilter()
+ *
+ * Convert the pattern of a line filter from the ANSI codepage (the codepage
+ * of the command line) to the codepage of the input, check its syntax and
+ * find the longest run of literal characters without quantifier, which
+ * every matching line contains. The buffers of the compiled filter are
+ * taken from an arena.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int CompileLineFilter(const char *pPattern, unsigned int codepage,
+                      Arena *pArena, CompiledLineFilter *pCompiled,
+                      ErrBlock *pEb)
+{
+    wchar_t *pWidePattern;
+    unsigned int widePatternSizeBytes;
+    unsigned int numberOfWideCharacters;
+    BOOL yUsedDefaultChar = FALSE;
+    const char *p;
+    const char *pPatternEnd;
+    const char *pRunStart = NULL;
+    unsigned int runSizeBytes = 0;
+    ErrBlock eb;
+
+    if (codepage == CODEPAGE_UTF16LE || codepage == CODEPAGE_UTF16BE)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Line filters do not support UTF16 input");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    if (ConvToZeroTerminatedWideCharNewBuffer(pPattern,
+        (unsigned int)strlen(pPattern), CP_ACP, 0, pArena, &pWidePattern,
+        &widePatternSizeBytes, &eb))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Pattern conversion failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        return -1;
+    }
+    numberOfWideCharacters = widePatternSizeBytes / sizeof(wchar_t) - 1;
+
+    /* characters missing in the input codepage must not become '?' (UTF8
+       has all characters and does not support the default character) */
+    pCompiled->patternSizeBytes = 0;
+    if (numberOfWideCharacters != 0)
+    {
+        pCompiled->patternSizeBytes = WideCharToMultiByte(codepage, 0,
+            pWidePattern, numberOfWideCharacters, NULL, 0, NULL,
+            codepage == CP_UTF8 ? NULL : &yUsedDefaultChar);
+    }
+    pCompiled->pPattern = ArenaAlloc(pArena, pCompiled->patternSizeBytes + 1);
+    if (pCompiled->pPattern == NULL ||
+        (numberOfWideCharacters != 0 && pCompiled->patternSizeBytes == 0) ||
+        yUsedDefaultChar)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Pattern \"%s\" cannot be converted to codepage %u",
+                pPattern, codepage);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 3;
+        }
+        return -1;
+    }
+    if (numberOfWideCharacters != 0)
+    {
+        WideCharToMultiByte(codepage, 0, pWidePattern, numberOfWideCharacters,
+            pCompiled->pPattern, pCompiled->patternSizeBytes, NULL, NULL);
+    }
+
+    /* the atoms and state lists of the matching automaton: a pattern has
+       at most one atom per byte, also with '+' compiled as two atoms */
+    pCompiled->yUtf8 = (codepage == CP_UTF8);
+    pCompiled->numberOfAtoms = 0;
+    pCompiled->stateGeneration = 0;
+    pCompiled->pAtoms = ArenaAlloc(pArena, pCompiled->patternSizeBytes *
+        sizeof(RegexAtom) + 3 * (pCompiled->patternSizeBytes + 1) *
+        sizeof(unsigned int));
+    if (pCompiled->pAtoms == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate memory for pattern \"%s\"", pPattern);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 5;
+        }
+        return -1;
+    }
+    pCompiled->pStateMarks = (unsigned int *)(pCompiled->pAtoms +
+        pCompiled->patternSizeBytes);
+    pCompiled->pStateLists[0] = pCompiled->pStateMarks +
+        pCompiled->patternSizeBytes + 1;
+    pCompiled->pStateLists[1] = pCompiled->pStateLists[0] +
+        pCompiled->patternSizeBytes + 1;
+    memset(pCompiled->pStateMarks, 0,
+        (pCompiled->patternSizeBytes + 1) * sizeof(unsigned int));
+
+    /* syntax check, atoms and longest literal run */
+    pCompiled->pLiteral = NULL;
+    pCompiled->literalSizeBytes = 0;
+    p = pCompiled->pPattern;
+    pPatternEnd = p + pCompiled->patternSizeBytes;
+    pCompiled->yAnchoredStart = (p < pPatternEnd && *p == '^');
+    pCompiled->yAnchoredEnd = 0;
+    if (pCompiled->yAnchoredStart)
+        p++;
+    while (p < pPatternEnd)
+    {
+        const char *pAtomEnd;
+        RegexAtom *pAtom;
+
+        if (*p == '$' && p + 1 == pPatternEnd)
+        {
+            pCompiled->yAnchoredEnd = 1;
+            break;
+        }
+        pAtomEnd = RegexAtomEnd(p, pPatternEnd, pCompiled->yUtf8);
+        if (pAtomEnd == NULL || *p == '*' || *p == '+' || *p == '?')
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "Invalid pattern \"%s\" at offset %u", pPattern,
+                    (unsigned int)(p - pCompiled->pPattern));
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 4;
+            }
+            return -1;
+        }
+
+        /* plain characters without quantifier extend the literal run */
+        if (*p != '.' && *p != '[' && *p != '\\' &&
+            (pAtomEnd == pPatternEnd || (*pAtomEnd != '*' &&
+            *pAtomEnd != '?' && *pAtomEnd != '+')))
+        {
+            if (pRunStart == NULL)
+                pRunStart = p;
+            runSizeBytes = (unsigned int)(pAtomEnd - pRunStart);
+            if (runSizeBytes > pCompiled->literalSizeBytes)
+            {
+                pCompiled->pLiteral = pRunStart;
+                pCompiled->literalSizeBytes = runSizeBytes;
+            }
+        }
+        else
+        {
+            pRunStart = NULL;
+        }
+
+        pAtom = pCompiled->pAtoms + pCompiled->numberOfAtoms++;
+        pAtom->pAtom = p;
+        pAtom->pAtomEnd = pAtomEnd;
+        pAtom->quantifier = 0;
+        p = pAtomEnd;
+        if (p < pPatternEnd && (*p == '*' || *p == '?'))
+        {
+            pAtom->quantifier = *p++;
+        }
+        else if (p < pPatternEnd && *p == '+')
+        {
+            pAtom[1] = pAtom[0];
+            pAtom[1].quantifier = '*';
+            pCompiled->numberOfAtoms++;
+            p++;
+        }
+    }
+
+    return 0;
+}
+
+/* FilterLinesToNewBuffer()
+ *
+ * Allocate a buffer and fill it with the lines of a text that match the
+ * regular expression of a line filter, with the given number of context
+ * lines before and after each match; "--" lines separate groups of lines
+ * that are not adjacent. The text is searched in its own codepage, before
+ * it is decoded: the longest literal of the pattern is searched with
+ * FindLiteral() and only the lines containing it are matched with
+ * MatchRegex(). Lines end with a line feed, which (like a carriage return
+ * before it) is not part of the matched line. The buffer and the compiled
+ * filter are taken from an arena. Stores the address of the allocated buffer
+ * (released with the arena) and the size of the filtered text in output
+ * variables.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. When an error occurrs the values of the output
+ * pointers are undefined.
+ */
+int FilterLinesToNewBuffer(const char *pInputBuffer,
+                           unsigned int numberOfInputBytes,
+                           unsigned int codepage,
+                           const LineFilter *pLineFilter, Arena *pArena,
+                           char **ppAllocatedBuffer,
+                           unsigned int *pFilteredSizeBytes, ErrBlock *pEb)
+{
+    CompiledLineFilter filter;
+    char *pOutput = NULL;
+    unsigned int outputCapacityBytes = 0;
+    unsigned int outputSizeBytes = 0;
+    unsigned int groupStart = 0;    /* pending group of lines to copy */
+    unsigned int groupEnd = 0;
+    unsigned int yGroup = 0;
+    unsigned int pos = 0;
+    unsigned int i;
+
+    if (CompileLineFilter(pLineFilter->pPattern, codepage, pArena, &filter,
+        pEb))
+    {
+        return -1;
+    }
+
+    /* one group more after the input, to copy the last pending group */
+    while (pos <= numberOfInputBytes)
+    {
+        unsigned int lineStart;
+        unsigned int lineEnd;
+        unsigned int contextStart;
+        unsigned int contextEnd;
+        const char *p;
+
+        if (pos == numberOfInputBytes)
+        {
+            lineStart = numberOfInputBytes;
+        }
+        else if (filter.literalSizeBytes != 0)
+        {
+            /* next line with the literal */
+            p = FindLiteral(pInputBuffer + pos, numberOfInputBytes - pos,
+                filter.pLiteral, filter.literalSizeBytes);
+            lineStart = (p == NULL ? numberOfInputBytes :
+                (unsigned int)(p - pInputBuffer));
+            while (lineStart > pos && pInputBuffer[lineStart - 1] != '\n')
+                lineStart--;
+        }
+        else
+        {
+            lineStart = pos;
+        }
+
+        if (lineStart == numberOfInputBytes)
+        {
+            /* end of input: no more matches */
+            contextStart = numberOfInputBytes;
+            contextEnd = numberOfInputBytes;
+            lineEnd = numberOfInputBytes;
+        }
+        else
+        {
+            p = memchr(pInputBuffer + lineStart, '\n',
+                numberOfInputBytes - lineStart);
+            lineEnd = (p == NULL ? numberOfInputBytes :
+                (unsigned int)(p - pInputBuffer));
+            pos = (p == NULL ? numberOfInputBytes : lineEnd + 1);
+            if (lineEnd > lineStart && pInputBuffer[lineEnd - 1] == '\r')
+                lineEnd--;
+            if (!MatchRegex(&filter, pInputBuffer + lineStart,
+                lineEnd - lineStart))
+            {
+                continue;
+            }
+
+            /* the matching line with its context lines */
+            contextStart = lineStart;
+            for (i = 0; i < pLineFilter->contextLines && contextStart > 0;
+                i++)
+            {
+                contextStart--;
+                while (contextStart > 0 &&
+                    pInputBuffer[contextStart - 1] != '\n')
+                {
+                    contextStart--;
+                }
+            }
+            contextEnd = pos;
+            for (i = 0; i < pLineFilter->contextLines &&
+                contextEnd < numberOfInputBytes; i++)
+            {
+                p = memchr(pInputBuffer + contextEnd, '\n',
+                    numberOfInputBytes - contextEnd);
+                contextEnd = (p == NULL ? numberOfInputBytes :
+                    (unsigned int)(p - pInputBuffer) + 1);
+            }
+        }
+
+        /* extend the pending group or copy it and start a new one */
+        if (yGroup && contextStart <= groupEnd &&
+            lineStart != numberOfInputBytes)
+        {
+            groupEnd = (contextEnd > groupEnd ? contextEnd : groupEnd);
+            continue;
+        }
+        if (yGroup)
+        {
+            unsigned int ySeparator = (outputSizeBytes != 0 &&
+                pLineFilter->contextLines != 0);
+
+            if (ReserveBuffer(pArena, (void **)&pOutput, &outputCapacityBytes,
+                outputSizeBytes + (groupEnd - groupStart) + 3, pEb))
+            {
+                return -1;
+            }
+            if (ySeparator)
+            {
+                memcpy(pOutput + outputSizeBytes, "--\n", 3);
+                outputSizeBytes += 3;
+            }
+            memcpy(pOutput + outputSizeBytes, pInputBuffer + groupStart,
+                groupEnd - groupStart);
+            outputSizeBytes += groupEnd - groupStart;
+        }
+        if (lineStart == numberOfInputBytes)
+            break;
+        groupStart = contextStart;
+        groupEnd = contextEnd;
+        yGroup = 1;
+    }
+
+    /* an empty result still needs a buffer */
+    if (pOutput == NULL)
+    {
+        pOutput = ArenaAlloc(pArena, 1);
+        if (pOutput == NULL)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "Could not allocate buffer for filtered lines");
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 5;
+            }
+            return -1;
+        }
+    }
+
+    /* success */
+    *ppAllocatedBuffer = pOutput;
+    *pFilteredSizeBytes = outputSizeBytes;
+    return 0;
+}
+
+/* ConvToZeroTerminatedWideCharBuffer()
+ *
+ * Convert a given string (not zero terminated) in a given codepage to a wide
+ * character string and store it in a retained buffer (see ReserveBuffer()),
+ * which grows in an arena, adding a zero termination character. When yCrlf
+ * is set every line feed
+ * that does not follow a carriage return is converted to CR LF while
+ * decoding. Stores the size of the converted string (including the zero
+ * termination character) in an output variable.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. The retained buffer stays owned by the caller in
+ * any case.
+ */
+int ConvToZeroTerminatedWideCharBuffer(const char *pInputBuffer,
+                                       unsigned int numberOfInputBytes,
+                                       unsigned int codepage,
+                                       unsigned int yCrlf, Arena *pArena,
+                                       wchar_t **ppWideCharBuffer,
+                                       unsigned int *pBufferCapacityBytes,
+                                       unsigned int *pWideCharSizeBytes,
+                                       ErrBlock *pEb)
+{
+    int retval;
+    int numberOfWideCharacters;
+    unsigned int numberOfLoneLineFeeds = 0;
+    unsigned int inputPos = 0;
+    unsigned int outputPos = 0;
+    wchar_t *pWideCharBuf;
+    const wchar_t *pDecodeTable;
+    unsigned int yUtf16 = (codepage == CODEPAGE_UTF16LE ||
+        codepage == CODEPAGE_UTF16BE);
+
+    /* single-byte codepages with a built-in table are decoded without the OS:
+       every input byte results in exactly one wide character */
+    pDecodeTable = GetSingleByteDecodeTable(codepage);
+
+    if (pDecodeTable != NULL)
+    {
+        numberOfWideCharacters = numberOfInputBytes;
+    }
+    else if (yUtf16)
+    {
+        /* UTF16 needs no conversion (an odd last byte is dropped) */
+        numberOfWideCharacters = DecodeUtf16String(pInputBuffer,
+            numberOfInputBytes / sizeof(wchar_t),
+            codepage == CODEPAGE_UTF16BE, yCrlf, NULL);
+    }
+    else if (numberOfInputBytes != 0)
+    {
+        numberOfWideCharacters = MultiByteToWideChar(codepage, 0, pInputBuffer,
+            numberOfInputBytes, NULL, 0);
+        if (numberOfWideCharacters == 0)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "MultiByteToWideChar() space detection failed, "
+                    "GetLastError() = 0x%X", GetLastError());
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 1;
+            }
+            return -1;
+        }
+    }
+    else
+    {
+        numberOfWideCharacters = 0;
+    }
+
+    /* every line feed byte is a line feed character in the supported
+       codepages, so the inserted carriage returns are counted on the input */
+    if (yCrlf && !yUtf16)
+        numberOfLoneLineFeeds = CountLoneLineFeeds(pInputBuffer,
+            numberOfInputBytes);
+
+    if (ReserveBuffer(pArena, (void **)ppWideCharBuffer, pBufferCapacityBytes,
+        (numberOfWideCharacters + numberOfLoneLineFeeds + 1) *
+        sizeof(wchar_t), NULL))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate conversion buffer");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        return -1;
+    }
+    pWideCharBuf = *ppWideCharBuffer;
+
+    if (yUtf16)
+    {
+        DecodeUtf16String(pInputBuffer, numberOfInputBytes / sizeof(wchar_t),
+            codepage == CODEPAGE_UTF16BE, yCrlf, pWideCharBuf);
+        inputPos = numberOfInputBytes;
+        outputPos = numberOfWideCharacters;
+    }
+
+    /* decode line by line, the line feeds found with memchr() are written
+       as CR LF (a single segment without yCrlf) */
+    while (inputPos < numberOfInputBytes)
+    {
+        const char *pLineFeed = NULL;
+        unsigned int segmentEnd = numberOfInputBytes;
+
+        if (numberOfLoneLineFeeds != 0)
+        {
+            pLineFeed = memchr(pInputBuffer + inputPos, '\n',
+                numberOfInputBytes - inputPos);
+            if (pLineFeed != NULL)
+                segmentEnd = (unsigned int)(pLineFeed - pInputBuffer);
+        }
+
+        if (segmentEnd == inputPos)
+        {
+            /* empty segment */
+        }
+        else if (pDecodeTable != NULL)
+        {
+            DecodeSingleByteString(
+                (const unsigned char *)pInputBuffer + inputPos,
+                segmentEnd - inputPos, pDecodeTable, pWideCharBuf + outputPos);
+            outputPos += segmentEnd - inputPos;
+        }
+        else
+        {
+            retval = MultiByteToWideChar(codepage, 0,
+                pInputBuffer + inputPos, segmentEnd - inputPos,
+                pWideCharBuf + outputPos,
+                numberOfWideCharacters + numberOfLoneLineFeeds - outputPos);
+            if (retval == 0)
+            {
+                if (pEb != NULL)
+                {
+                    snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                        "MultiByteToWideChar() conversion failed, "
+                        "GetLastError() = 0x%X", GetLastError());
+                    pEb->errDescription[sizeof(pEb->errDescription) - 1] =
+                        '\0';
+                    pEb->functionSpecificErrorCode = 3;
+                }
+                return -1;
+            }
+            outputPos += retval;
+        }
+
+        if (pLineFeed == NULL)
+            break;
+        if (segmentEnd == 0 || pInputBuffer[segmentEnd - 1] != '\r')
+            pWideCharBuf[outputPos++] = L'\r';
+        pWideCharBuf[outputPos++] = L'\n';
+        inputPos = segmentEnd + 1;
+    }
+    pWideCharBuf[outputPos] = L'\0';
+
+    /* success */
+    *pWideCharSizeBytes = (outputPos + 1) * sizeof(wchar_t);
+    return 0;
+}
+
+/* ConvToZeroTerminatedWideCharNewBuffer()
+ *
+ * Convert a given string (not zero terminated) in a given codepage to a wide
+ * character string and store it in a buffer allocated from an arena, adding
+ * a zero termination character and optionally converting line feeds to CR LF
+ * (see ConvToZeroTerminatedWideCharBuffer()). Stores the address of the
+ * allocated buffer (released with the arena) and the size of the converted
+ * string in output variables.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. When an error occurrs the values of the output
+ * pointers are undefined.
+ */
+int ConvToZeroTerminatedWideCharNewBuffer(const char *pInputBuffer,
+                                          unsigned int numberOfInputBytes,
+                                          unsigned int codepage,
+                                          unsigned int yCrlf, Arena *pArena,
+                                          wchar_t **ppAllocatedWideCharBuffer,
+                                          unsigned int *pAllocatedBufSizeBytes,
+                                          ErrBlock *pEb)
+{
+    wchar_t *pWideCharBuf = NULL;
+    unsigned int wideCharBufCapacityBytes = 0;
+
+    if (ConvToZeroTerminatedWideCharBuffer(pInputBuffer, numberOfInputBytes,
+        codepage, yCrlf, pArena, &pWideCharBuf, &wideCharBufCapacityBytes,
+        pAllocatedBufSizeBytes, pEb))
+    {
+        return -1;
+    }
+
+    /* success */
+    *ppAllocatedWideCharBuffer = pWideCharBuf;
+    return 0;
+}
+
+/* EncodeSingleByteStringAsUtf8()
+ *
+ * Convert a string (not zero terminated) in a single-byte codepage to UTF8
+ * using a decode table. When the output pointer is NULL nothing is written
+ * (for size calculation). Runs of ASCII characters are handled 16 bytes at a
+ * time when SSE2 is available.
+ *
+ * Returns the number of UTF8 bytes (written or required).
+ */
+unsigned int EncodeSingleByteStringAsUtf8(const unsigned char *pInput,
+                                          unsigned int numberOfInputBytes,
+                                          const wchar_t *pDecodeTable,
+                                          char *pOutput)
+{
+    unsigned int i = 0;
+    unsigned int outputBytes = 0;
+
+    while (i < numberOfInputBytes)
+    {
+        unsigned int codepoint;
+
+#ifdef CCLIP_USE_SSE2
+        if (i + 16 <= numberOfInputBytes)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i *)(pInput + i));
+            if (_mm_movemask_epi8(chunk) == 0)
+            {
+                if (pOutput != NULL)
+                    _mm_storeu_si128((__m128i *)(pOutput + outputBytes), chunk);
+                i += 16;
+                outputBytes += 16;
+                continue;
+            }
+        }
+#endif /* #ifdef CCLIP_USE_SSE2 */
+
+        codepoint = pDecodeTable[pInput[i++]];
+        if (codepoint < 0x80)
+        {
+            if (pOutput != NULL)
+                pOutput[outputBytes] = (char)codepoint;
+            outputBytes += 1;
+        }
+        else if (codepoint < 0x800)
+        {
+            if (pOutput != NULL)
+            {
+                pOutput[outputBytes] = (char)(0xC0 | (codepoint >> 6));
+                pOutput[outputBytes + 1] = (char)(0x80 | (codepoint & 0x3F));
+            }
+            outputBytes += 2;
+        }
+        else
+        {
+            if (pOutput != NULL)
+            {
+                pOutput[outputBytes] = (char)(0xE0 | (codepoint >> 12));
+                pOutput[outputBytes + 1] =
+                    (char)(0x80 | ((codepoint >> 6) & 0x3F));
+                pOutput[outputBytes + 2] = (char)(0x80 | (codepoint & 0x3F));
+            }
+            outputBytes += 3;
+        }
+    }
+
+    return outputBytes;
+}
+
+/* ConvToUtf8NewBuffer()
+ *
+ * Convert a given string (not zero terminated) in a given codepage to UTF8,
+ * which is the internal representation of all text processing, and store it
+ * in a buffer allocated from an arena, adding a zero termination byte (the
+ * intermediate UTF16 string of OS conversions stays in the arena as well).
+ * Stores the address of the allocated buffer (released with the arena) and
+ * the number of UTF8 bytes (without the zero termination byte) in output
+ * variables.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. When an error occurrs the values of the output
+ * pointers are undefined.
+ */
+int ConvToUtf8NewBuffer(const char *pInputBuffer,
+                        unsigned int numberOfInputBytes,
+                        unsigned int codepage, Arena *pArena,
+                        char **ppAllocatedUtf8Buffer,
+                        unsigned int *pUtf8SizeBytes,
+                        ErrBlock *pEb)
+{
+    char *pUtf8Buf;
+    unsigned int utf8SizeBytes;
+    const wchar_t *pDecodeTable;
+
+    pDecodeTable = GetSingleByteDecodeTable(codepage);
+    if (pDecodeTable != NULL)
+    {
+        /* single-byte codepage with a built-in table: one pass, no OS call */
+        utf8SizeBytes = EncodeSingleByteStringAsUtf8(
+            (const unsigned char *)pInputBuffer, numberOfInputBytes,
+            pDecodeTable, NULL);
+        pUtf8Buf = ArenaAlloc(pArena, utf8SizeBytes + 1);
+        if (pUtf8Buf == NULL)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "Could not allocate UTF8 conversion buffer");
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 1;
+            }
+            return -1;
+        }
+        EncodeSingleByteStringAsUtf8((const unsigned char *)pInputBuffer,
+            numberOfInputBytes, pDecodeTable, pUtf8Buf);
+    }
+    else
+    {
+        /* any other codepage: let the OS convert via UTF16 */
+        ErrBlock convErrBlock;
+        wchar_t *pWideCharBuf;
+        unsigned int wideCharBufSizeBytes;
+        int numberOfWideCharacters;
+        int retval;
+
+        retval = ConvToZeroTerminatedWideCharNewBuffer(pInputBuffer,
+            numberOfInputBytes, codepage, 0, pArena, &pWideCharBuf,
+            &wideCharBufSizeBytes, &convErrBlock);
+        if (retval != 0)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "Conversion to wide characters failed (%s)",
+                    convErrBlock.errDescription);
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 2;
+            }
+            return -1;
+        }
+        numberOfWideCharacters =
+            wideCharBufSizeBytes / sizeof(wchar_t) - 1;
+
+        if (numberOfWideCharacters != 0)
+        {
+            retval = WideCharToMultiByte(CP_UTF8, 0, pWideCharBuf,
+                numberOfWideCharacters, NULL, 0, NULL, NULL);
+            if (retval == 0)
+            {
+                if (pEb != NULL)
+                {
+                    snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                        "WideCharToMultiByte() space detection failed, "
+                        "GetLastError() = 0x%X", GetLastError());
+                    pEb->errDescription[
+                        sizeof(pEb->errDescription) - 1] = '\0';
+                    pEb->functionSpecificErrorCode = 3;
+                }
+                return -1;
+            }
+            utf8SizeBytes = (unsigned int)retval;
+        }
+        else
+        {
+            utf8SizeBytes = 0;
+        }
+
+        pUtf8Buf = ArenaAlloc(pArena, utf8SizeBytes + 1);
+        if (pUtf8Buf == NULL)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "Could not allocate UTF8 conversion buffer");
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 1;
+            }
+            return -1;
+        }
+
+        if (utf8SizeBytes != 0)
+        {
+            retval = WideCharToMultiByte(CP_UTF8, 0, pWideCharBuf,
+                numberOfWideCharacters, pUtf8Buf, utf8SizeBytes, NULL, NULL);
+            if (retval == 0)
+            {
+                if (pEb != NULL)
+                {
+                    snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                        "WideCharToMultiByte() conversion failed, "
+                        "GetLastError() = 0x%X", GetLastError());
+                    pEb->errDescription[
+                        sizeof(pEb->errDescription) - 1] = '\0';
+                    pEb->functionSpecificErrorCode = 4;
+                }
+                return -1;
+            }
+        }
+    }
+    pUtf8Buf[utf8SizeBytes] = '\0';
+
+    /* success */
+    *ppAllocatedUtf8Buffer = pUtf8Buf;
+    *pUtf8SizeBytes = utf8SizeBytes;
+    return 0;
+}
+
+typedef struct ClipboardAcquisition_
+{
+    unsigned int numberOfAcquisitions;
+    LONG volatile numberOfFailures;
+    LONG volatile numberOfRetries;
+    double maxAcquireTimeMs;
+    unsigned int histogram[CLIPBOARD_ACQUIRE_HISTOGRAM_BUCKETS];
+#ifdef _DEBUG
+    int simulatedContentionAttempts;
+#endif
+} ClipboardAcquisition;
+
+/* statistics of all OpenClipboard() calls of this process: failures and
+   retries are counted with interlocked operations, the other members are
+   only changed while the clipboard is open, which excludes other threads */
+static ClipboardAcquisition clipboardAcquisition;
+
+/* settings used when no ClipboardOptions structure is given */
+static const ClipboardOptions defaultClipboardOptions = {1000, 0};
+
+/* clipboard history: the last published payloads in a file of fixed size in
+ * the local application data directory, mapped into memory by every cclip
+ * process while it holds the history mutex. The header with the entry table
+ * is followed by the data ring, every entry stores its CF_UNICODETEXT data
+ * followed by its CF_HTML data. */
+#define CLIPBOARD_HISTORY_MAGIC         0x48504C43  /* "CLPH" */
+#define CLIPBOARD_HISTORY_VERSION       1
+#define CLIPBOARD_HISTORY_MAX_ENTRIES   16
+#define CLIPBOARD_HISTORY_DATA_BYTES    (16 * 1024 * 1024)
+#define CLIPBOARD_HISTORY_MUTEX_NAME    "Local\\cclipClipboardHistory"
+
+typedef struct ClipboardHistoryEntry_
+{
+    unsigned int dataOffset;
+    unsigned int textSizeBytes;
+    unsigned int htmlSizeBytes;
+    unsigned int hash;
+} ClipboardHistoryEntry;
+
+typedef struct ClipboardHistoryHeader_
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int dataSizeBytes;
+    unsigned int writeOffset;
+    unsigned int numberOfEntries;
+    /* entry indices, the most recent entry first */
+    unsigned int order[CLIPBOARD_HISTORY_MAX_ENTRIES];
+    ClipboardHistoryEntry entries[CLIPBOARD_HISTORY_MAX_ENTRIES];
+} ClipboardHistoryHeader;
+
+/* the mapped clipboard history while it is opened by a call, see
+   OpenClipboardHistory() */
+typedef struct ClipboardHistory_
+{
+    unsigned int yLocked;
+    HANDLE mutex;
+    HANDLE fileHandle;
+    HANDLE mapping;
+    ClipboardHistoryHeader *pHeader;
+    unsigned char *pData;
+} ClipboardHistory;
+
+typedef struct ClipboardHistoryStats_
+{
+    unsigned int numberOfAdded;
+    unsigned int numberOfDuplicates;
+    unsigned int numberOfRecalls;
+    unsigned int numberOfEvictions;
+    unsigned int numberOfSkipped;
+    LONG volatile numberOfFailures;
+    double maxLockTimeMs;
+} ClipboardHistoryStats;
+
+/* statistics of the clipboard history of this process: failures are
+   counted with interlocked operations, the other members are only changed
+   while holding the history mutex, which excludes other threads */
+static ClipboardHistoryStats clipboardHistoryStats;
+
+/* TryOpenClipboard()
+ *
+ * Single attempt to open the clipboard. Debug builds can simulate another
+ * process holding the clipboard: the attempts are refused while the count
+ * set by AcquireClipboard() lasts.
+ *
+ * Returns nonzero if the clipboard was opened.
+ */
+int TryOpenClipboard(void)
+{
+#ifdef _DEBUG
+    if (clipboardAcquisition.simulatedContentionAttempts > 0)
+    {
+        clipboardAcquisition.simulatedContentionAttempts--;
+        SetLastError(ERROR_ACCESS_DENIED);
+        return 0;
+    }
+#endif
+    return OpenClipboard(0);
+}
+
+/* AcquireClipboard()
+ *
+ * Open the clipboard, retrying while another process holds it open. The
+ * delay between attempts starts with giving up the time slice and doubles
+ * up to 64 ms, until the given timeout has passed. The time to acquire the
+ * clipboard is recorded in the statistics. In debug builds the first
+ * attempts of every call are refused, as many as the
+ * CCLIP_SIMULATE_CONTENTION environment variable gives.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int AcquireClipboard(unsigned int timeoutMs, ErrBlock *pEb)
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER startTime;
+    LARGE_INTEGER currentTime;
+    DWORD delayMs = 0;
+    double elapsedMs = 0.0;
+    unsigned int bucket;
+    int yOpened;
+#ifdef _DEBUG
+    char *pEnv = getenv("CCLIP_SIMULATE_CONTENTION");
+
+    clipboardAcquisition.simulatedContentionAttempts =
+        (pEnv != NULL ? strtol(pEnv, NULL, 0) : 0);
+#endif
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&startTime);
+
+    for (;;)
+    {
+        yOpened = TryOpenClipboard();
+        QueryPerformanceCounter(&currentTime);
+        elapsedMs = (double)(currentTime.QuadPart - startTime.QuadPart) *
+            1000.0 / (double)frequency.QuadPart;
+        if (yOpened || elapsedMs >= timeoutMs)
+            break;
+
+        InterlockedIncrement(&clipboardAcquisition.numberOfRetries);
+        if (delayMs > timeoutMs - elapsedMs)
+            delayMs = (DWORD)(timeoutMs - elapsedMs);
+        Sleep(delayMs);
+        if (delayMs == 0)
+            delayMs = 1;
+        else if (delayMs < 64)
+            delayMs *= 2;
+    }
+
+    if (!yOpened)
+    {
+        InterlockedIncrement(&clipboardAcquisition.numberOfFailures);
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "OpenClipboard() failed for %u ms, GetLastError() = 0x%X",
+                timeoutMs, GetLastError());
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    clipboardAcquisition.numberOfAcquisitions++;
+    if (elapsedMs > clipboardAcquisition.maxAcquireTimeMs)
+        clipboardAcquisition.maxAcquireTimeMs = elapsedMs;
+    for (bucket = 0; bucket < CLIPBOARD_ACQUIRE_HISTOGRAM_BUCKETS - 1 &&
+        elapsedMs >= (double)(1u << bucket); bucket++)
+        ;
+    clipboardAcquisition.histogram[bucket]++;
+
+    return 0;
+}
+
+/* InitClipboardOptions()
+ *
+ * Set the default settings in a ClipboardOptions structure: the clipboard
+ * is opened with a timeout of 1000 ms and the clipboard history is disabled.
+ */
+void InitClipboardOptions(ClipboardOptions *pOptions)
+{
+    *pOptions = defaultClipboardOptions;
+}
+
+/* GetClipboardAcquisitionStats()
+ *
+ * Copy the statistics of all OpenClipboard() calls of this process.
+ */
+void GetClipboardAcquisitionStats(ClipboardAcquisitionStats *pStats)
+{
+    unsigned int i;
+
+    pStats->numberOfAcquisitions = clipboardAcquisition.numberOfAcquisitions;
+    pStats->numberOfFailures =
+        (unsigned int)clipboardAcquisition.numberOfFailures;
+    pStats->numberOfRetries =
+        (unsigned int)clipboardAcquisition.numberOfRetries;
+    pStats->maxAcquireTimeMs = clipboardAcquisition.maxAcquireTimeMs;
+    for (i = 0; i < CLIPBOARD_ACQUIRE_HISTOGRAM_BUCKETS; i++)
+        pStats->histogram[i] = clipboardAcquisition.histogram[i];
+}
+
+/* PrintStats()
+ *
+ * Print statistics of this run to stderr, registered with atexit().
+ */
+void PrintStats(void)
+{
+    static const char *pStageNames[NUMBER_OF_ALLOCATION_STAGES] =
+        {"setup", "read", "filter", "render", "clipboard"};
+    AllocationStats stats;
+    unsigned int i;
+
+    fprintf(stderr, "clipboard acquisitions: %u, failures: %u, retries: %u, "
+        "max time: %.3f ms\n", clipboardAcquisition.numberOfAcquisitions,
+        (unsigned int)clipboardAcquisition.numberOfFailures,
+        (unsigned int)clipboardAcquisition.numberOfRetries,
+        clipboardAcquisition.maxAcquireTimeMs);
+    for (i = 0; i < CLIPBOARD_ACQUIRE_HISTOGRAM_BUCKETS; i++)
+    {
+        if (i == 0)
+            fprintf(stderr, "    < 1 ms:");
+        else if (i == CLIPBOARD_ACQUIRE_HISTOGRAM_BUCKETS - 1)
+            fprintf(stderr, "    >= %u ms:", 1u << (i - 1));
+        else
+            fprintf(stderr, "    %u-%u ms:", 1u << (i - 1), 1u << i);
+        fprintf(stderr, " %u\n", clipboardAcquisition.histogram[i]);
+    }
+    fprintf(stderr, "clipboard history: added: %u, duplicates: %u, "
+        "recalled: %u, evicted: %u, skipped: %u, failures: %u, "
+        "max lock time: %.3f ms\n", clipboardHistoryStats.numberOfAdded,
+        clipboardHistoryStats.numberOfDuplicates,
+        clipboardHistoryStats.numberOfRecalls,
+        clipboardHistoryStats.numberOfEvictions,
+        clipboardHistoryStats.numberOfSkipped,
+        (unsigned int)clipboardHistoryStats.numberOfFailures,
+        clipboardHistoryStats.maxLockTimeMs);
+    fprintf(stderr, "allocations by stage:\n");
+    for (i = 0; i < NUMBER_OF_ALLOCATION_STAGES; i++)
+    {
+        GetAllocationStats((AllocationStage)i, &stats);
+        fprintf(stderr, "    %s: %u allocations, %u reallocations, "
+            "%u frees, peak %lu bytes\n", pStageNames[i],
+            stats.numberOfAllocations, stats.numberOfReallocations,
+            stats.numberOfFrees, (unsigned long)stats.peakBytes);
+    }
+}
+
+/* WriteMultipleFormatsToClipboard()
+ *
+ * Replace the clipboard contents with data in one or more clipboard formats.
+ * All formats are set while the clipboard is opened once, so that they are
+ * available at the same time. The clipboard is opened with the timeout of
+ * the given options (NULL for the defaults, see InitClipboardOptions()).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int WriteMultipleFormatsToClipboard(const ClipboardData *pClipboardData,
+                                    unsigned int numberOfFormats,
+                                    const ClipboardOptions *pOptions,
+                                    ErrBlock *pEb)
+{
+    HGLOBAL hGlobalMem;
+    unsigned char *pGlobalMem;
+    unsigned int i;
+
+    if (pOptions == NULL)
+        pOptions = &defaultClipboardOptions;
+
+    if (AcquireClipboard(pOptions->timeoutMs, pEb))
+        return -1;
+
+    if (!EmptyClipboard())
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "EmptyClipboard() failed, GetLastError() = 0x%X",
+                GetLastError());
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        CloseClipboard();
+        return -1;
+    }
+
+    for (i = 0; i < numberOfFormats; i++)
+    {
+        hGlobalMem = GlobalAlloc(GMEM_MOVEABLE, pClipboardData[i].sizeBytes);
+        if (hGlobalMem == NULL)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "GlobalAlloc() failed, GetLastError() = 0x%X",
+                    GetLastError());
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 3;
+            }
+            CloseClipboard();
+            return -1;
+        }
+
+        pGlobalMem = GlobalLock(hGlobalMem);
+        if (pGlobalMem == NULL)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "GlobalLock() failed, GetLastError() = 0x%X",
+                    GetLastError());
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 4;
+            }
+            GlobalFree(hGlobalMem);
+            CloseClipboard();
+            return -1;
+        }
+
+        CopyMemory(pGlobalMem, pClipboardData[i].pData,
+            pClipboardData[i].sizeBytes);
+        GlobalUnlock(hGlobalMem);
+
+        /* on success the system owns the memory - it must not be freed */
+        if (!SetClipboardData(pClipboardData[i].format, hGlobalMem))
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "SetClipboardData() failed, GetLastError() = 0x%X",
+                    GetLastError());
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 5;
+            }
+            GlobalFree(hGlobalMem);
+            CloseClipboard();
+            return -1;
+        }
+    }
+
+    CloseClipboard();
+
+    return 0;
+}
+
+/* WriteToClipboard()
+ *
+ * Replace the clipboard contents with data in a single clipboard format. See
+ * WriteMultipleFormatsToClipboard() for return values.
+ */
+int WriteToClipboard(unsigned int format, const void *pData,
+                     unsigned int sizeBytes, const ClipboardOptions *pOptions,
+                     ErrBlock *pEb)
+{
+    ClipboardData clipboardData;
+
+    clipboardData.format = format;
+    clipboardData.pData = pData;
+    clipboardData.sizeBytes = sizeBytes;
+    return WriteMultipleFormatsToClipboard(&clipboardData, 1, pOptions, pEb);
+}
+
+/* WriteAllToFile()
+ *
+ * Write a buffer completely to a file handle, issuing large writes directly
+ * from the given memory.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int WriteAllToFile(HANDLE fileHandle, const void *pData, unsigned int sizeBytes,
+                   ErrBlock *pEb)
+{
+    const char *pWritePointer = pData;
+
+    while (sizeBytes != 0)
+    {
+        DWORD writtenBytes;
+        DWORD bytesToWrite = (sizeBytes > 0x100000 ? 0x100000 : sizeBytes);
+
+        if (!WriteFile(fileHandle, pWritePointer, bytesToWrite, &writtenBytes,
+            NULL) || writtenBytes == 0)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "WriteFile() failed, GetLastError() = 0x%X",
+                    GetLastError());
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 1;
+            }
+            return -1;
+        }
+        pWritePointer += writtenBytes;
+        sizeBytes -= writtenBytes;
+    }
+
+    return 0;
+}
+
+/* size of the staging buffer for wide characters converted to a codepage */
+#define CONVERSION_CHUNK_BUFFER_BYTES 0x40000
+
+/* WriteWideCharsThroughBuffer()
+ *
+ * Convert a wide character string (not zero terminated) to a given codepage
+ * and write it to a file handle in chunks through a staging buffer provided
+ * by the caller (see WriteWideCharsToFile()).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int WriteWideCharsThroughBuffer(HANDLE fileHandle, const wchar_t *pWideChars,
+                                unsigned int numberOfWideChars,
+                                unsigned int codepage, char *pChunkBuffer,
+                                unsigned int chunkBufferSizeBytes,
+                                ErrBlock *pEb)
+{
+    unsigned int charPos = 0;
+
+    if (codepage == CODEPAGE_UTF16LE)
+    {
+        return WriteAllToFile(fileHandle, pWideChars,
+            numberOfWideChars * sizeof(wchar_t), pEb);
+    }
+
+    while (charPos < numberOfWideChars)
+    {
+        /* a wide character needs at most 4 bytes in any codepage */
+        unsigned int chunkChars = chunkBufferSizeBytes / 4;
+        int convertedBytes;
+
+        if (chunkChars > numberOfWideChars - charPos)
+            chunkChars = numberOfWideChars - charPos;
+        /* do not split a surrogate pair */
+        else if (pWideChars[charPos + chunkChars - 1] >= 0xD800 &&
+                 pWideChars[charPos + chunkChars - 1] < 0xDC00)
+            chunkChars--;
+
+        convertedBytes = WideCharToMultiByte(codepage, 0,
+            pWideChars + charPos, chunkChars, pChunkBuffer,
+            chunkBufferSizeBytes, NULL, NULL);
+        if (convertedBytes == 0)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "WideCharToMultiByte() conversion failed, "
+                    "GetLastError() = 0x%X", GetLastError());
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 2;
+            }
+            return -1;
+        }
+
+        if (WriteAllToFile(fileHandle, pChunkBuffer, convertedBytes, pEb))
+            return -1;
+        charPos += chunkChars;
+    }
+
+    return 0;
+}
+
+/* WriteWideCharsToFile()
+ *
+ * Convert a wide character string (not zero terminated) to a given codepage
+ * and write it to a file handle. The conversion is done in chunks through a
+ * fixed size buffer, so memory usage does not depend on the string length.
+ * UTF16LE (codepage 1200) is written directly from the given memory.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int WriteWideCharsToFile(HANDLE fileHandle, const wchar_t *pWideChars,
+                         unsigned int numberOfWideChars, unsigned int codepage,
+                         ErrBlock *pEb)
+{
+    char *pChunkBuffer;
+    int retval;
+
+    if (codepage == CODEPAGE_UTF16LE)
+    {
+        return WriteAllToFile(fileHandle, pWideChars,
+            numberOfWideChars * sizeof(wchar_t), pEb);
+    }
+
+    pChunkBuffer = AllocMemory(CONVERSION_CHUNK_BUFFER_BYTES);
+    if (pChunkBuffer == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate output conversion buffer");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    retval = WriteWideCharsThroughBuffer(fileHandle, pWideChars,
+        numberOfWideChars, codepage, pChunkBuffer,
+        CONVERSION_CHUNK_BUFFER_BYTES, pEb);
+    FreeMemory(pChunkBuffer);
+    return retval;
+}
+
+/* WriteUtf8ToFile()
+ *
+ * Write a UTF8 string (not zero terminated) in a given codepage to a file
+ * handle. UTF8 output is written directly from the given memory, other
+ * codepages are converted in chunks through fixed size buffers.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int WriteUtf8ToFile(HANDLE fileHandle, const char *pUtf8,
+                    unsigned int utf8SizeBytes, unsigned int codepage,
+                    ErrBlock *pEb)
+{
+    Arena arena;
+    wchar_t *pChunkBuffer;
+    char *pOutputChunkBuffer = NULL;
+    unsigned int chunkBufferChars = 0x10000;
+    unsigned int bytePos = 0;
+
+    if (codepage == CP_UTF8)
+        return WriteAllToFile(fileHandle, pUtf8, utf8SizeBytes, pEb);
+
+    /* both staging buffers are allocated once for all chunks */
+    InitArena(&arena);
+    pChunkBuffer = ArenaAlloc(&arena, chunkBufferChars * sizeof(wchar_t));
+    if (codepage != CODEPAGE_UTF16LE)
+        pOutputChunkBuffer = ArenaAlloc(&arena, CONVERSION_CHUNK_BUFFER_BYTES);
+    if (pChunkBuffer == NULL ||
+        (codepage != CODEPAGE_UTF16LE && pOutputChunkBuffer == NULL))
+    {
+        FreeArena(&arena);
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate output conversion buffer");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    while (bytePos < utf8SizeBytes)
+    {
+        /* a UTF8 byte results in at most one wide character */
+        unsigned int chunkBytes = chunkBufferChars;
+        int convertedChars;
+
+        if (chunkBytes >= utf8SizeBytes - bytePos)
+        {
+            chunkBytes = utf8SizeBytes - bytePos;
+        }
+        else
+        {
+            /* do not split a UTF8 sequence: end before its lead byte */
+            unsigned int end = chunkBytes;
+            while (end > chunkBytes - 4 &&
+                ((unsigned char)pUtf8[bytePos + end] & 0xC0) == 0x80)
+            {
+                end--;
+            }
+            chunkBytes = end;
+        }
+
+        convertedChars = MultiByteToWideChar(CP_UTF8, 0, pUtf8 + bytePos,
+            chunkBytes, pChunkBuffer, chunkBufferChars);
+        if (convertedChars == 0)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "MultiByteToWideChar() conversion failed, "
+                    "GetLastError() = 0x%X", GetLastError());
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 2;
+            }
+            FreeArena(&arena);
+            return -1;
+        }
+
+        if (WriteWideCharsThroughBuffer(fileHandle, pChunkBuffer,
+            convertedChars, codepage, pOutputChunkBuffer,
+            CONVERSION_CHUNK_BUFFER_BYTES, pEb))
+        {
+            FreeArena(&arena);
+            return -1;
+        }
+        bytePos += chunkBytes;
+    }
+
+    FreeArena(&arena);
+    return 0;
+}
+
+/* ParseClipboardHtmlOffset()
+ *
+ * Find a "Key:number" entry in the description of CF_HTML data (which ends
+ * where the HTML code starts) and convert the number.
+ *
+ * Returns zero on success or -1 if the entry was not found.
+ */
+int ParseClipboardHtmlOffset(const char *pHtml, unsigned int htmlSizeBytes,
+                             const char *pKey, unsigned int *pValue)
+{
+    unsigned int keySizeBytes = (unsigned int)strlen(pKey);
+    unsigned int pos;
+
+    for (pos = 0; pos + keySizeBytes < htmlSizeBytes && pHtml[pos] != '<';
+        pos++)
+    {
+        if ((pos == 0 || pHtml[pos - 1] == '\n') &&
+            memcmp(pHtml + pos, pKey, keySizeBytes) == 0 &&
+            pHtml[pos + keySizeBytes] == ':')
+        {
+            unsigned int value = 0;
+            pos += keySizeBytes + 1;
+            if (pos >= htmlSizeBytes || pHtml[pos] < '0' || pHtml[pos] > '9')
+                return -1;
+            while (pos < htmlSizeBytes && pHtml[pos] >= '0' &&
+                pHtml[pos] <= '9')
+            {
+                value = value * 10 + (pHtml[pos] - '0');
+                pos++;
+            }
+            *pValue = value;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* ReadClipboardToFile()
+ *
+ * Write the clipboard contents to a file handle, either the CF_UNICODETEXT
+ * text or the fragment of the "HTML Format" data (between the StartFragment
+ * and EndFragment offsets of its description), converted to a given
+ * codepage. The data is written from the locked clipboard memory without
+ * copying it into a buffer of its full size. The clipboard is opened with
+ * the timeout of the given options (NULL for the defaults).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int ReadClipboardToFile(HANDLE fileHandle, unsigned int yHtml,
+                        unsigned int codepage,
+                        const ClipboardOptions *pOptions, ErrBlock *pEb)
+{
+    HANDLE hClipboardData;
+    const unsigned char *pClipboardMem;
+    unsigned int clipboardMemSizeBytes;
+    unsigned int format;
+    ErrBlock eb;
+    int retval;
+
+    if (yHtml)
+        format = RegisterClipboardFormat("HTML Format");
+    else
+        format = CF_UNICODETEXT;
+    if (pOptions == NULL)
+        pOptions = &defaultClipboardOptions;
+
+    if (AcquireClipboard(pOptions->timeoutMs, pEb))
+        return -1;
+
+    hClipboardData = GetClipboardData(format);
+    if (hClipboardData == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "No %s data in the clipboard", yHtml ? "HTML" : "text");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        CloseClipboard();
+        return -1;
+    }
+
+    pClipboardMem = GlobalLock(hClipboardData);
+    if (pClipboardMem == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "GlobalLock() failed, GetLastError() = 0x%X",
+                GetLastError());
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 3;
+        }
+        CloseClipboard();
+        return -1;
+    }
+    clipboardMemSizeBytes = (unsigned int)GlobalSize(hClipboardData);
+
+    if (yHtml)
+    {
+        unsigned int startFragment;
+        unsigned int endFragment;
+
+        if (ParseClipboardHtmlOffset((const char *)pClipboardMem,
+                clipboardMemSizeBytes, "StartFragment", &startFragment) ||
+            ParseClipboardHtmlOffset((const char *)pClipboardMem,
+                clipboardMemSizeBytes, "EndFragment", &endFragment) ||
+            startFragment > endFragment ||
+            endFragment > clipboardMemSizeBytes)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "Invalid fragment offsets in the HTML description");
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 4;
+            }
+            GlobalUnlock(hClipboardData);
+            CloseClipboard();
+            return -1;
+        }
+
+        retval = WriteUtf8ToFile(fileHandle,
+            (const char *)pClipboardMem + startFragment,
+            endFragment - startFragment, codepage, &eb);
+    }
+    else
+    {
+        const wchar_t *pText = (const wchar_t *)pClipboardMem;
+        unsigned int maxChars = clipboardMemSizeBytes / sizeof(wchar_t);
+        unsigned int numberOfChars = 0;
+
+        /* the text ends at the zero termination or the end of the memory */
+        while (numberOfChars < maxChars && pText[numberOfChars] != L'\0')
+            numberOfChars++;
+
+        retval = WriteWideCharsToFile(fileHandle, pText, numberOfChars,
+            codepage, &eb);
+    }
+
+    GlobalUnlock(hClipboardData);
+    CloseClipboard();
+
+    if (retval != 0)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Writing clipboard data failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 5;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/* HashFnv1a()
+ *
+ * Continue a 32 bit FNV-1a hash over a block of data. The first block is
+ * hashed with the offset basis 2166136261 as initial hash value.
+ *
+ * Returns the hash value.
+ */
+unsigned int HashFnv1a(const void *pData, unsigned int sizeBytes,
+                       unsigned int hash)
+{
+    const unsigned char *pBytes = pData;
+    unsigned int i;
+
+    for (i = 0; i < sizeBytes; i++)
+        hash = (hash ^ pBytes[i]) * 16777619u;
+    return hash;
+}
+
+/* CloseClipboardHistory()
+ *
+ * Unmap the clipboard history of a ClipboardHistory structure and release
+ * the history mutex. Handles that were not opened are skipped, so that this
+ * also cleans up after a failed OpenClipboardHistory().
+ */
+void CloseClipboardHistory(ClipboardHistory *pHistory)
+{
+    if (pHistory->pHeader != NULL)
+        UnmapViewOfFile(pHistory->pHeader);
+    if (pHistory->mapping != NULL)
+        CloseHandle(pHistory->mapping);
+    if (pHistory->fileHandle != NULL &&
+        pHistory->fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(pHistory->fileHandle);
+    }
+    if (pHistory->yLocked)
+        ReleaseMutex(pHistory->mutex);
+    if (pHistory->mutex != NULL)
+        CloseHandle(pHistory->mutex);
+
+    pHistory->pHeader = NULL;
+    pHistory->pData = NULL;
+    pHistory->mapping = NULL;
+    pHistory->fileHandle = NULL;
+    pHistory->yLocked = 0;
+    pHistory->mutex = NULL;
+}
+
+/* OpenClipboardHistory()
+ *
+ * Lock the clipboard history with its named mutex, waiting up to a given
+ * timeout, and map the history file into a ClipboardHistory structure, which
+ * is created when it does not exist. The history is reset when the file is
+ * new, invalid or of another version and when a process ended while holding
+ * the mutex (its last update may be incomplete). The time to get the lock is
+ * recorded in the statistics. CloseClipboardHistory() must be called after
+ * success.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int OpenClipboardHistory(ClipboardHistory *pHistory, unsigned int timeoutMs,
+                         ErrBlock *pEb)
+{
+    char path[MAX_PATH];
+    DWORD pathLength;
+    DWORD waitResult;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER startTime;
+    LARGE_INTEGER endTime;
+    double lockTimeMs;
+    ClipboardHistoryHeader *pHeader;
+    unsigned int yValid;
+    unsigned int i;
+    const unsigned int mappingSizeBytes = sizeof(ClipboardHistoryHeader) +
+        CLIPBOARD_HISTORY_DATA_BYTES;
+
+    /* history file in %LOCALAPPDATA%\cclip, or in %TEMP%\cclip on systems
+       without a local application data directory */
+    pathLength = GetEnvironmentVariable("LOCALAPPDATA", path, MAX_PATH);
+    if (pathLength == 0 || pathLength >= MAX_PATH)
+        pathLength = GetEnvironmentVariable("TEMP", path, MAX_PATH);
+    if (pathLength == 0 ||
+        pathLength + sizeof("\\cclip\\history.dat") > MAX_PATH)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "No directory for the clipboard history file found");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+    strcat(path, "\\cclip");
+    CreateDirectory(path, NULL);    /* fails when it exists already */
+    strcat(path, "\\history.dat");
+
+    memset(pHistory, 0, sizeof(*pHistory));
+    pHistory->mutex = CreateMutex(NULL, FALSE,
+        CLIPBOARD_HISTORY_MUTEX_NAME);
+    if (pHistory->mutex == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "CreateMutex() failed, GetLastError() = 0x%X",
+                GetLastError());
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        return -1;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&startTime);
+    waitResult = WaitForSingleObject(pHistory->mutex,
+        timeoutMs);
+    QueryPerformanceCounter(&endTime);
+    if (waitResult != WAIT_OBJECT_0 && waitResult != WAIT_ABANDONED)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Clipboard history locked for %u ms, WaitForSingleObject() "
+                "= 0x%X", timeoutMs, waitResult);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 3;
+        }
+        CloseClipboardHistory(pHistory);
+        return -1;
+    }
+    pHistory->yLocked = 1;
+    lockTimeMs = (double)(endTime.QuadPart - startTime.QuadPart) * 1000.0 /
+        (double)frequency.QuadPart;
+    if (lockTimeMs > clipboardHistoryStats.maxLockTimeMs)
+        clipboardHistoryStats.maxLockTimeMs = lockTimeMs;
+
+    pHistory->fileHandle = CreateFile(path,
+        GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (pHistory->fileHandle == INVALID_HANDLE_VALUE)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not open clipboard history file %s, GetLastError() "
+                "= 0x%X", path, GetLastError());
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 4;
+        }
+        CloseClipboardHistory(pHistory);
+        return -1;
+    }
+
+    /* the mapping extends a new file to the full size */
+    pHistory->mapping = CreateFileMapping(pHistory->fileHandle,
+        NULL, PAGE_READWRITE, 0, mappingSizeBytes, NULL);
+    if (pHistory->mapping == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "CreateFileMapping() failed, GetLastError() = 0x%X",
+                GetLastError());
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 5;
+        }
+        CloseClipboardHistory(pHistory);
+        return -1;
+    }
+
+    pHeader = MapViewOfFile(pHistory->mapping, FILE_MAP_ALL_ACCESS,
+        0, 0, mappingSizeBytes);
+    if (pHeader == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "MapViewOfFile() failed, GetLastError() = 0x%X",
+                GetLastError());
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 6;
+        }
+        CloseClipboardHistory(pHistory);
+        return -1;
+    }
+    pHistory->pHeader = pHeader;
+    pHistory->pData = (unsigned char *)(pHeader + 1);
+
+    /* check the header and every entry, the data must be within the ring */
+    yValid = (waitResult == WAIT_OBJECT_0 &&
+        pHeader->magic == CLIPBOARD_HISTORY_MAGIC &&
+        pHeader->version == CLIPBOARD_HISTORY_VERSION &&
+        pHeader->dataSizeBytes == CLIPBOARD_HISTORY_DATA_BYTES &&
+        pHeader->writeOffset <= pHeader->dataSizeBytes &&
+        pHeader->numberOfEntries <= CLIPBOARD_HISTORY_MAX_ENTRIES);
+    for (i = 0; yValid && i < pHeader->numberOfEntries; i++)
+    {
+        const ClipboardHistoryEntry *pEntry;
+
+        if (pHeader->order[i] >= CLIPBOARD_HISTORY_MAX_ENTRIES)
+        {
+            yValid = 0;
+            break;
+        }
+        pEntry = &pHeader->entries[pHeader->order[i]];
+        yValid = (pEntry->textSizeBytes <= pHeader->dataSizeBytes &&
+            pEntry->htmlSizeBytes <= pHeader->dataSizeBytes -
+            pEntry->textSizeBytes &&
+            pEntry->dataOffset <= pHeader->dataSizeBytes -
+            pEntry->textSizeBytes - pEntry->htmlSizeBytes);
+    }
+    if (!yValid)
+    {
+        memset(pHeader, 0, sizeof(*pHeader));
+        pHeader->magic = CLIPBOARD_HISTORY_MAGIC;
+        pHeader->version = CLIPBOARD_HISTORY_VERSION;
+        pHeader->dataSizeBytes = CLIPBOARD_HISTORY_DATA_BYTES;
+    }
+
+    return 0;
+}
+
+/* MoveClipboardHistoryEntryToFront()
+ *
+ * Make the entry at a given position of the order list of the clipboard
+ * history the most recent entry.
+ */
+void MoveClipboardHistoryEntryToFront(ClipboardHistoryHeader *pHeader,
+                                      unsigned int orderPosition)
+{
+    unsigned int entryIndex = pHeader->order[orderPosition];
+
+    memmove(&pHeader->order[1], &pHeader->order[0],
+        orderPosition * sizeof(pHeader->order[0]));
+    pHeader->order[0] = entryIndex;
+}
+
+/* AddClipboardHistoryEntry()
+ *
+ * Record published CF_UNICODETEXT and CF_HTML data as the most recent entry
+ * of the clipboard history, when the history is enabled in the given options
+ * (NULL for the defaults, which disable it). Data equal to an
+ * entry (same FNV-1a hash and same bytes) only moves that entry to the
+ * front. New data is written at the write offset of the data ring, or at
+ * its start when it does not fit before the end; the entries whose data it
+ * overwrites and the oldest entry of a full table are evicted. Data larger
+ * than the ring is skipped.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int AddClipboardHistoryEntry(const void *pText, unsigned int textSizeBytes,
+                             const void *pHtml, unsigned int htmlSizeBytes,
+                             const ClipboardOptions *pOptions, ErrBlock *pEb)
+{
+    ClipboardHistory history;
+    ClipboardHistoryHeader *pHeader;
+    ClipboardHistoryEntry *pEntry;
+    unsigned int dataOffset;
+    unsigned int entryIndex;
+    unsigned int hash;
+    unsigned int i;
+    unsigned int j;
+
+    if (pOptions == NULL)
+        pOptions = &defaultClipboardOptions;
+    if (!pOptions->yHistory)
+        return 0;
+
+    hash = HashFnv1a(pText, textSizeBytes, 2166136261u);
+    hash = HashFnv1a(pHtml, htmlSizeBytes, hash);
+
+    if (OpenClipboardHistory(&history, pOptions->timeoutMs, pEb))
+    {
+        InterlockedIncrement(&clipboardHistoryStats.numberOfFailures);
+        return -1;
+    }
+    pHeader = history.pHeader;
+
+    /* duplicate of an entry: only moved to the front */
+    for (i = 0; i < pHeader->numberOfEntries; i++)
+    {
+        pEntry = &pHeader->entries[pHeader->order[i]];
+        if (pEntry->hash == hash &&
+            pEntry->textSizeBytes == textSizeBytes &&
+            pEntry->htmlSizeBytes == htmlSizeBytes &&
+            memcmp(history.pData + pEntry->dataOffset, pText,
+                textSizeBytes) == 0 &&
+            memcmp(history.pData + pEntry->dataOffset +
+                textSizeBytes, pHtml, htmlSizeBytes) == 0)
+        {
+            MoveClipboardHistoryEntryToFront(pHeader, i);
+            clipboardHistoryStats.numberOfDuplicates++;
+            CloseClipboardHistory(&history);
+            return 0;
+        }
+    }
+
+    if (textSizeBytes > pHeader->dataSizeBytes ||
+        htmlSizeBytes > pHeader->dataSizeBytes - textSizeBytes)
+    {
+        clipboardHistoryStats.numberOfSkipped++;
+        CloseClipboardHistory(&history);
+        return 0;
+    }
+
+    dataOffset = pHeader->writeOffset;
+    if (textSizeBytes + htmlSizeBytes > pHeader->dataSizeBytes - dataOffset)
+        dataOffset = 0;
+
+    /* evict the entries whose data is overwritten, then the oldest entry
+       when the table is still full */
+    i = 0;
+    while (i < pHeader->numberOfEntries)
+    {
+        pEntry = &pHeader->entries[pHeader->order[i]];
+        if (pEntry->dataOffset < dataOffset + textSizeBytes + htmlSizeBytes &&
+            dataOffset < pEntry->dataOffset + pEntry->textSizeBytes +
+            pEntry->htmlSizeBytes)
+        {
+            pHeader->numberOfEntries--;
+            memmove(&pHeader->order[i], &pHeader->order[i + 1],
+                (pHeader->numberOfEntries - i) * sizeof(pHeader->order[0]));
+            clipboardHistoryStats.numberOfEvictions++;
+        }
+        else
+        {
+            i++;
+        }
+    }
+    if (pHeader->numberOfEntries == CLIPBOARD_HISTORY_MAX_ENTRIES)
+    {
+        pHeader->numberOfEntries--;
+        clipboardHistoryStats.numberOfEvictions++;
+    }
+
+    /* the first entry index that is not in the order list */
+    for (entryIndex = 0; entryIndex < CLIPBOARD_HISTORY_MAX_ENTRIES;
+        entryIndex++)
+    {
+        for (j = 0; j < pHeader->numberOfEntries &&
+            pHeader->order[j] != entryIndex; j++)
+            ;
+        if (j == pHeader->numberOfEntries)
+            break;
+    }
+
+    CopyMemory(history.pData + dataOffset, pText, textSizeBytes);
+    CopyMemory(history.pData + dataOffset + textSizeBytes, pHtml,
+        htmlSizeBytes);
+    pEntry = &pHeader->entries[entryIndex];
+    pEntry->dataOffset = dataOffset;
+    pEntry->textSizeBytes = textSizeBytes;
+    pEntry->htmlSizeBytes = htmlSizeBytes;
+    pEntry->hash = hash;
+    memmove(&pHeader->order[1], &pHeader->order[0],
+        pHeader->numberOfEntries * sizeof(pHeader->order[0]));
+    pHeader->order[0] = entryIndex;
+    pHeader->numberOfEntries++;
+
+    /* the next entry starts 4 byte aligned (the ring size is a multiple
+       of 4) */
+    pHeader->writeOffset = (dataOffset + textSizeBytes + htmlSizeBytes + 3) &
+        ~3u;
+
+    clipboardHistoryStats.numberOfAdded++;
+    CloseClipboardHistory(&history);
+    return 0;
+}
+
+/* RecallClipboardHistoryEntry()
+ *
+ * Write an entry of the clipboard history to the clipboard again, entry
+ * number 1 being the most recent entry. The mapped data is handed to the
+ * clipboard directly, without reading or rendering anything, while the
+ * history is locked. The entry becomes the most recent entry. The history
+ * and the clipboard are opened with the timeout of the given options (NULL
+ * for the defaults).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int RecallClipboardHistoryEntry(unsigned int entryNumber,
+                                const ClipboardOptions *pOptions,
+                                ErrBlock *pEb)
+{
+    ClipboardHistory history;
+    ClipboardHistoryHeader *pHeader;
+    const ClipboardHistoryEntry *pEntry;
+    ClipboardData clipboardData[2];
+    ErrBlock eb;
+
+    if (pOptions == NULL)
+        pOptions = &defaultClipboardOptions;
+
+    if (OpenClipboardHistory(&history, pOptions->timeoutMs, &eb))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Opening the clipboard history failed (%s)",
+                eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        InterlockedIncrement(&clipboardHistoryStats.numberOfFailures);
+        return -1;
+    }
+    pHeader = history.pHeader;
+
+    if (entryNumber == 0 || entryNumber > pHeader->numberOfEntries)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Clipboard history entry %u does not exist (%u entries)",
+                entryNumber, pHeader->numberOfEntries);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        CloseClipboardHistory(&history);
+        return -1;
+    }
+
+    pEntry = &pHeader->entries[pHeader->order[entryNumber - 1]];
+    clipboardData[0].format = CF_UNICODETEXT;
+    clipboardData[0].pData = history.pData + pEntry->dataOffset;
+    clipboardData[0].sizeBytes = pEntry->textSizeBytes;
+    clipboardData[1].format = RegisterClipboardFormat("HTML Format");
+    clipboardData[1].pData = history.pData + pEntry->dataOffset +
+        pEntry->textSizeBytes;
+    clipboardData[1].sizeBytes = pEntry->htmlSizeBytes;
+    if (WriteMultipleFormatsToClipboard(clipboardData, 2, pOptions, &eb))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Writing to the clipboard failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 3;
+        }
+        CloseClipboardHistory(&history);
+        return -1;
+    }
+
+    MoveClipboardHistoryEntryToFront(pHeader, entryNumber - 1);
+    clipboardHistoryStats.numberOfRecalls++;
+    CloseClipboardHistory(&history);
+    return 0;
+}
+
+/* CreateFormatInfo()
+ *
+ * Allocate an empty FormatInfo structure from an arena. Its tag arrays grow
+ * in the same arena and are released with it.
+ *
+ * Returns the address of the structure or NULL if it could not be allocated.
+ */
+FormatInfo *CreateFormatInfo(Arena *pArena)
+{
+    FormatInfo *pFormatInfo = ArenaAlloc(pArena, sizeof(FormatInfo));
+
+    if (pFormatInfo != NULL)
+    {
+        memset(pFormatInfo, 0, sizeof(FormatInfo));
+        pFormatInfo->pArena = pArena;
+    }
+    return pFormatInfo;
+}
+
+/* ClearFormatInfo()
+ *
+ * Remove all tags from a FormatInfo structure, keeping its arrays for reuse.
+ */
+void ClearFormatInfo(FormatInfo *pFormatInfo)
+{
+    pFormatInfo->numberOfTags = 0;
+    pFormatInfo->positionDeltaBytes = 0;
+    pFormatInfo->lastBytePos = 0;
+}
+
+/* AppendFormatInfoTag()
+ *
+ * Append a tag to a FormatInfo structure, growing its arrays as needed. Tags
+ * must be appended in ascending position order and the parameter must fit
+ * into FORMATINFO_PARAMETER_BITS bits.
+ *
+ * Returns zero on success or -1 if memory could not be allocated or the tag
+ * violates the restrictions above. In case of an error the FormatInfo
+ * structure is left unchanged.
+ */
+int AppendFormatInfoTag(FormatInfo *pFormatInfo, unsigned int bytePos,
+                        TagType type, unsigned int parameter,
+                        unsigned int yClose)
+{
+    unsigned int delta;
+
+    if (bytePos < pFormatInfo->lastBytePos ||
+        parameter >= (1u << FORMATINFO_PARAMETER_BITS) ||
+        (unsigned int)type > FORMATINFO_TYPE_MASK)
+    {
+        return -1;
+    }
+
+    if (pFormatInfo->numberOfTags == pFormatInfo->tagWordCapacity)
+    {
+        unsigned int newCapacity = (pFormatInfo->tagWordCapacity == 0 ?
+            64 : pFormatInfo->tagWordCapacity * 2);
+        unsigned int *pNewTagWords = ArenaRealloc(pFormatInfo->pArena,
+            pFormatInfo->pTagWords,
+            pFormatInfo->tagWordCapacity * sizeof(*pNewTagWords),
+            newCapacity * sizeof(*pNewTagWords));
+        if (pNewTagWords == NULL)
+            return -1;
+        pFormatInfo->pTagWords = pNewTagWords;
+        pFormatInfo->tagWordCapacity = newCapacity;
+    }
+
+    /* a delta needs at most 5 bytes with 7 bits per byte */
+    if (pFormatInfo->positionDeltaCapacity - pFormatInfo->positionDeltaBytes
+        < 5)
+    {
+        unsigned int newCapacity = (pFormatInfo->positionDeltaCapacity == 0 ?
+            128 : pFormatInfo->positionDeltaCapacity * 2);
+        unsigned char *pNewDeltas = ArenaRealloc(pFormatInfo->pArena,
+            pFormatInfo->pPositionDeltas,
+            pFormatInfo->positionDeltaCapacity, newCapacity);
+        if (pNewDeltas == NULL)
+            return -1;
+        pFormatInfo->pPositionDeltas = pNewDeltas;
+        pFormatInfo->positionDeltaCapacity = newCapacity;
+    }
+
+    /* position: delta to the previous tag, 7 bits per byte, the high bit
+       marks that more bytes follow */
+    delta = bytePos - pFormatInfo->lastBytePos;
+    while (delta >= 0x80)
+    {
+        pFormatInfo->pPositionDeltas[pFormatInfo->positionDeltaBytes++] =
+            (unsigned char)(0x80 | (delta & 0x7F));
+        delta >>= 7;
+    }
+    pFormatInfo->pPositionDeltas[pFormatInfo->positionDeltaBytes++] =
+        (unsigned char)delta;
+    pFormatInfo->lastBytePos = bytePos;
+
+    pFormatInfo->pTagWords[pFormatInfo->numberOfTags++] =
+        (unsigned int)type |
+        (yClose ? FORMATINFO_CLOSE_FLAG : 0) |
+        (parameter << FORMATINFO_PARAMETER_SHIFT);
+    return 0;
+}
+
+/* InitFormatInfoIterator()
+ *
+ * Prepare walking the tags of a FormatInfo structure (may be NULL) in
+ * position order. Optional head and tail tag arrays are returned before and
+ * after the tags of the structure without copying anything, their positions
+ * must not be greater (head) or smaller (tail) than those of the structure.
+ */
+void InitFormatInfoIterator(FormatInfoIterator *pIterator,
+                            const FormatInfo *pFormatInfo,
+                            const FormatInfoTag *pHeadTags,
+                            unsigned int numberOfHeadTags,
+                            const FormatInfoTag *pTailTags,
+                            unsigned int numberOfTailTags)
+{
+    pIterator->pFormatInfo = pFormatInfo;
+    pIterator->pHeadTags = pHeadTags;
+    pIterator->numberOfHeadTags = numberOfHeadTags;
+    pIterator->pTailTags = pTailTags;
+    pIterator->numberOfTailTags = numberOfTailTags;
+    pIterator->tagIndex = 0;
+    pIterator->positionDeltaReadIndex = 0;
+    pIterator->bytePos = 0;
+}
+
+/* NextFormatInfoTag()
+ *
+ * Decode the next tag of a FormatInfoIterator into an output variable.
+ *
+ * Returns 1 if a tag was stored or 0 if all tags have been returned.
+ */
+int NextFormatInfoTag(FormatInfoIterator *pIterator, FormatInfoTag *pTag)
+{
+    unsigned int numberOfBodyTags = (pIterator->pFormatInfo == NULL ? 0 :
+        pIterator->pFormatInfo->numberOfTags);
+    unsigned int index = pIterator->tagIndex;
+
+    if (index < pIterator->numberOfHeadTags)
+    {
+        *pTag = pIterator->pHeadTags[index];
+    }
+    else if (index - pIterator->numberOfHeadTags < numberOfBodyTags)
+    {
+        const FormatInfo *pFormatInfo = pIterator->pFormatInfo;
+        unsigned int word;
+        unsigned int delta = 0;
+        unsigned int shift = 0;
+        unsigned char deltaByte;
+
+        do
+        {
+            deltaByte = pFormatInfo->pPositionDeltas[
+                pIterator->positionDeltaReadIndex++];
+            delta |= (unsigned int)(deltaByte & 0x7F) << shift;
+            shift += 7;
+        } while (deltaByte & 0x80);
+        pIterator->bytePos += delta;
+
+        word = pFormatInfo->pTagWords[index - pIterator->numberOfHeadTags];
+        pTag->bytePos = pIterator->bytePos;
+        pTag->type = (TagType)(word & FORMATINFO_TYPE_MASK);
+        pTag->parameter = word >> FORMATINFO_PARAMETER_SHIFT;
+        pTag->yClose = (word & FORMATINFO_CLOSE_FLAG) ? 1 : 0;
+    }
+    else if (index - pIterator->numberOfHeadTags - numberOfBodyTags <
+        pIterator->numberOfTailTags)
+    {
+        *pTag = pIterator->pTailTags[
+            index - pIterator->numberOfHeadTags - numberOfBodyTags];
+    }
+    else
+    {
+        return 0;
+    }
+
+    pIterator->tagIndex++;
+    return 1;
+}
+
+/* HTML markup of the tag types. Tag types with a CSS style are written as
+   <span> elements with a class named after the tag type ("c" followed by the
+   TagType value), the styles of the used classes are defined once in the
+   <style> element of the CF_HTML data. */
+typedef struct TagMarkup_
+{
+    const char *pOpen;
+    const char *pClose;
+    const char *pStyle;
+} TagMarkup;
+
+static const TagMarkup tagMarkup[] =
+{
+    /* TagTypePreWithAttributes */
+    {"<pre>", "</pre>", NULL},
+    /* TagTypeUnderscore */
+    {"<u>", "</u>", NULL},
+    /* TagTypeFgBlue */
+    {"<span class=\"c2\">", "</span>", "color:#0000C0"},
+    /* TagTypeFgGreen */
+    {"<span class=\"c3\">", "</span>", "color:#008000"},
+    /* TagTypeFgRed */
+    {"<span class=\"c4\">", "</span>", "color:#C00000"},
+    /* TagTypeBgBlue */
+    {"<span class=\"c5\">", "</span>", "background-color:#C0C0FF"},
+    /* TagTypeBgGreen */
+    {"<span class=\"c6\">", "</span>", "background-color:#C0FFC0"},
+    /* TagTypeBgRed */
+    {"<span class=\"c7\">", "</span>", "background-color:#FFC0C0"},
+    /* TagTypeBold */
+    {"<b>", "</b>", NULL},
+    /* TagTypeFgMagenta */
+    {"<span class=\"c9\">", "</span>", "color:#A000A0"},
+    /* TagTypeFgYellow */
+    {"<span class=\"c10\">", "</span>", "color:#808000"},
+    /* TagTypeFgGray */
+    {"<span class=\"c11\">", "</span>", "color:#808080"},
+    /* TagTypePreBlock */
+    {"<pre class=\"c12\">", "</pre>", "margin:0"}
+};
+
+/* GenerateHtmlMarkupFromFormatInfoTag()
+ *
+ * Generate HTML code in UTF8 (without a zero termination byte) from a TagType,
+ * a parameter and a boolean flag (indicating if the tag is a closing tag) and
+ * store it at a specified address. When the specified buffer size is 0 no data
+ * is written (for size calculation). Otherwise the function fails if the
+ * specified buffer size if smaller than the generated HTML code.
+ *
+ * Returns the number of bytes required by the generated UTF8 string (without
+ * a zero termination byte) on success or -1 in case of an error.
+ */
+int GenerateHtmlMarkupFromFormatInfoTag(TagType type, unsigned parameter,
+                                        unsigned int yClose,
+                                        char *pOutputBuffer,
+                                        unsigned int bufferSizeBytes)
+{
+    int returnValue;
+    const char *pTag = NULL;
+
+    if ((unsigned int)type < sizeof(tagMarkup) / sizeof(tagMarkup[0]))
+        pTag = (yClose ? tagMarkup[type].pClose : tagMarkup[type].pOpen);
+
+    if (pTag == NULL)
+        return -1;
+
+    returnValue = strlen(pTag);
+
+    if (bufferSizeBytes != 0)
+    {
+        if (bufferSizeBytes >= (unsigned int)returnValue)
+            memcpy(pOutputBuffer, pTag, returnValue);
+        else
+            returnValue = -1;
+    }
+
+    return returnValue;
+}
+
+/* EscapeHtmlText()
+ *
+ * Copy UTF8 text (not zero terminated) and replace the characters that have
+ * a special meaning in HTML by character entities. When the CR LF text start
+ * pointer is not NULL, line feeds that do not follow a carriage return are
+ * also replaced by CR LF; the pointer is the start of the whole text that
+ * the input is part of, so that a carriage return before the input is found.
+ * Blocks of 16 bytes without any of these characters are skipped at once
+ * when SSE2 is available. When the output pointer is NULL no data is written
+ * (for size calculation).
+ *
+ * Returns the number of bytes of the escaped text (written or required).
+ */
+unsigned int EscapeHtmlText(const char *pInput, unsigned int inputSizeBytes,
+                            const char *pCrlfTextStart, char *pOutput)
+{
+    unsigned int outputBytes = 0;
+    unsigned int runStart = 0;
+    unsigned int i;
+#ifdef CCLIP_USE_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i ampersand = _mm_set1_epi8('&');
+    const __m128i lessThan = _mm_set1_epi8('<');
+    const __m128i greaterThan = _mm_set1_epi8('>');
+    const __m128i lineFeed = (pCrlfTextStart != NULL ?
+        _mm_set1_epi8('\n') : _mm_setzero_si128());
+#endif /* #ifdef CCLIP_USE_SSE2 */
+
+    for (i = 0; i < inputSizeBytes; i++)
+    {
+        const char *pEntity;
+        unsigned int entitySizeBytes;
+
+#ifdef CCLIP_USE_SSE2
+        /* NUL bytes only match the line feed vector without CR LF
+           conversion, they are checked like any other byte */
+        if ((i & 15) == 0 && i + 16 <= inputSizeBytes)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i *)(pInput + i));
+            __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                    _mm_cmpeq_epi8(chunk, ampersand)),
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, lessThan),
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, greaterThan),
+                        _mm_cmpeq_epi8(chunk, lineFeed))));
+            if (_mm_movemask_epi8(special) == 0)
+            {
+                i += 15;
+                continue;
+            }
+        }
+#endif /* #ifdef CCLIP_USE_SSE2 */
+
+        switch (pInput[i])
+        {
+        case '"':
+            pEntity = "&quot;";
+            entitySizeBytes = 6;
+            break;
+        case '&':
+            pEntity = "&amp;";
+            entitySizeBytes = 5;
+            break;
+        case '<':
+            pEntity = "&lt;";
+            entitySizeBytes = 4;
+            break;
+        case '>':
+            pEntity = "&gt;";
+            entitySizeBytes = 4;
+            break;
+        case '\n':
+            if (pCrlfTextStart == NULL ||
+                (pInput + i > pCrlfTextStart && *(pInput + i - 1) == '\r'))
+            {
+                continue;
+            }
+            pEntity = "\r\n";
+            entitySizeBytes = 2;
+            break;
+        default:
+            continue;
+        }
+
+        /* copy the run of unchanged characters and the entity */
+        if (pOutput != NULL)
+        {
+            memcpy(pOutput + outputBytes, pInput + runStart, i - runStart);
+            memcpy(pOutput + outputBytes + (i - runStart), pEntity,
+                entitySizeBytes);
+        }
+        outputBytes += (i - runStart) + entitySizeBytes;
+        runStart = i + 1;
+    }
+
+    if (pOutput != NULL)
+    {
+        memcpy(pOutput + outputBytes, pInput + runStart,
+            inputSizeBytes - runStart);
+    }
+    outputBytes += inputSizeBytes - runStart;
+
+    return outputBytes;
+}
+
+/* CF_HTML description, the offsets are filled by
+   FillClipboardHtmlDescription(), and HTML code before and after the
+   fragment (the <style> element is generated by GenerateClipboardHtmlStart()
+   between the head start and end strings) */
+static const char clipboardHtmlDescription[] =
+    "Version:0.9\r\nStartHTML:0000000000\r\n"
+    "EndHTML:0000000000\r\nStartFragment:0000000000\r\n"
+    "EndFragment:0000000000\r\n";
+static const char clipboardHtmlHeadStartString[] =
+    "<html>\r\n<head>\r\n<style>\r\n";
+static const char clipboardHtmlHeadEndString[] =
+    "</style>\r\n</head>\r\n";
+static const char clipboardHtmlBodyStartString[] =
+    "<body>\r\n<!--StartFragment-->";
+static const char clipboardHtmlEndString[] =
+    "<!--EndFragment-->\r\n</body>\r\n</html>";
+
+/* CopyStringWithoutTermination()
+ *
+ * Copy a zero terminated string without its zero termination byte. When the
+ * output pointer is NULL no data is written (for size calculation).
+ *
+ * Returns the number of bytes of the string.
+ */
+unsigned int CopyStringWithoutTermination(const char *pString, char *pOutput)
+{
+    unsigned int stringSizeBytes = (unsigned int)strlen(pString);
+
+    if (pOutput != NULL)
+        memcpy(pOutput, pString, stringSizeBytes);
+
+    return stringSizeBytes;
+}
+
+/* GetFormatInfoStyleClasses()
+ *
+ * Determine the CSS classes used by the tags of a FormatInfo structure (may
+ * be NULL).
+ *
+ * Returns a bit mask with bit (1 << TagType) set for each used tag type that
+ * has a CSS style, including the <pre> blocks when the text is split into
+ * blocks of the given size (see InitPreTags()).
+ */
+unsigned int GetFormatInfoStyleClasses(const FormatInfo *pFormatInfo,
+                                       unsigned int preBlockSizeBytes)
+{
+    FormatInfoIterator iterator;
+    FormatInfoTag tag;
+    unsigned int styleClasses = 0;
+
+    InitFormatInfoIterator(&iterator, pFormatInfo, NULL, 0, NULL, 0);
+    while (NextFormatInfoTag(&iterator, &tag))
+    {
+        if ((unsigned int)tag.type < sizeof(tagMarkup) / sizeof(tagMarkup[0])
+            && tagMarkup[tag.type].pStyle != NULL)
+        {
+            styleClasses |= 1u << tag.type;
+        }
+    }
+    if (preBlockSizeBytes != 0)
+        styleClasses |= 1u << TagTypePreBlock;
+
+    return styleClasses;
+}
+
+/* GenerateClipboardHtmlStart()
+ *
+ * Generate the start of CF_HTML data up to the start of the fragment: the
+ * description (with offsets to be filled by FillClipboardHtmlDescription())
+ * and the HTML code with a <style> element that defines the CSS classes in
+ * the given bit mask (see GetFormatInfoStyleClasses(), no <head> element is
+ * generated when no classes are used). When the output
+ * pointer is NULL no data is written (for size calculation).
+ *
+ * Returns the number of bytes of the generated string (written or required,
+ * without a zero termination byte).
+ */
+unsigned int GenerateClipboardHtmlStart(unsigned int styleClasses,
+                                        char *pOutput)
+{
+    char classDefinition[64];
+    unsigned int outputBytes = 0;
+    unsigned int i;
+
+    outputBytes += CopyStringWithoutTermination(clipboardHtmlDescription,
+        pOutput != NULL ? pOutput + outputBytes : NULL);
+    if (styleClasses == 0)
+    {
+        outputBytes += CopyStringWithoutTermination("<html>\r\n",
+            pOutput != NULL ? pOutput + outputBytes : NULL);
+    }
+    else
+    {
+        outputBytes += CopyStringWithoutTermination(
+            clipboardHtmlHeadStartString,
+            pOutput != NULL ? pOutput + outputBytes : NULL);
+        for (i = 0; i < sizeof(tagMarkup) / sizeof(tagMarkup[0]); i++)
+        {
+            if (!(styleClasses & (1u << i)) || tagMarkup[i].pStyle == NULL)
+                continue;
+            snprintf(classDefinition, sizeof(classDefinition),
+                ".c%u{%s}\r\n", i, tagMarkup[i].pStyle);
+            classDefinition[sizeof(classDefinition) - 1] = '\0';
+            outputBytes += CopyStringWithoutTermination(classDefinition,
+                pOutput != NULL ? pOutput + outputBytes : NULL);
+        }
+        outputBytes += CopyStringWithoutTermination(
+            clipboardHtmlHeadEndString,
+            pOutput != NULL ? pOutput + outputBytes : NULL);
+    }
+    outputBytes += CopyStringWithoutTermination(clipboardHtmlBodyStartString,
+        pOutput != NULL ? pOutput + outputBytes : NULL);
+
+    return outputBytes;
+}
+
+/* FillClipboardHtmlDescription()
+ *
+ * Write the offsets into the description of a complete CF_HTML buffer that
+ * starts with clipboardHtmlDescription and ends with clipboardHtmlEndString.
+ * The HTML code starts right after the description, the fragment starts at
+ * the given offset.
+ */
+void FillClipboardHtmlDescription(char *pHtmlBuffer,
+                                  unsigned int htmlSizeBytes,
+                                  unsigned int startFragment)
+{
+    char description[sizeof(clipboardHtmlDescription)];
+
+    snprintf(description, sizeof(description), "Version:0.9\r\n"
+        "StartHTML:%010u\r\nEndHTML:%010u\r\n"
+        "StartFragment:%010u\r\nEndFragment:%010u\r\n",
+        (unsigned int)strlen(clipboardHtmlDescription), htmlSizeBytes,
+        startFragment,
+        htmlSizeBytes - (unsigned int)strlen(clipboardHtmlEndString));
+    memcpy(pHtmlBuffer, description, strlen(clipboardHtmlDescription));
+}
+
+/* InitPreTags()
+ *
+ * Set up the <pre> tags around the whole input of a given size, passed to a
+ * FormatInfo iterator as head and tail tag so that the tags of a FormatInfo
+ * structure need not be copied. The maximum size in bytes of the text in
+ * each <pre> element is given as the <pre> block size: target applications
+ * lay out a huge <pre> element very slowly, so the text is split into blocks
+ * at line boundaries (see PreBlockIterator, a single line longer than the
+ * size is not split). A size of 0 puts the whole text into one <pre>
+ * element.
+ */
+void InitPreTags(FormatInfoTag *pPreTags, unsigned int inputSizeBytes,
+                 unsigned int preBlockSizeBytes)
+{
+    TagType preType = (preBlockSizeBytes != 0 ? TagTypePreBlock :
+        TagTypePreWithAttributes);
+
+    pPreTags[0].bytePos = 0;
+    pPreTags[0].type = preType;
+    pPreTags[0].parameter = 0;
+    pPreTags[0].yClose = 0;
+    // TODO set attributes for <pre> tag
+    pPreTags[1].bytePos = inputSizeBytes;
+    pPreTags[1].type = preType;
+    pPreTags[1].parameter = 0;
+    pPreTags[1].yClose = 1;
+}
+
+/* maximum number of open tags that are closed and reopened at a <pre> block
+   boundary, a boundary within more open tags is moved to the next line */
+#define PRE_BLOCK_MAX_OPEN_TAGS 16
+
+/* walks the tags of a FormatInfo structure and the <pre> tags like a
+   FormatInfoIterator and inserts the tags of the <pre> block boundaries (see
+   InitPreTags()): at a boundary all open tags (the <pre> tag being
+   the outermost one) are closed and reopened */
+typedef struct PreBlockIterator_
+{
+    FormatInfoIterator tagIterator;
+    const char *pText;
+    unsigned int textSizeBytes;
+    unsigned int blockSizeBytes;
+    unsigned int boundaryPos;
+    unsigned int boundaryTagIndex;
+    FormatInfoTag openTags[PRE_BLOCK_MAX_OPEN_TAGS];
+    unsigned int numberOfOpenTags;
+    unsigned int numberOfExcessOpenTags;
+    FormatInfoTag nextTag;
+    unsigned int yNextTag;
+} PreBlockIterator;
+
+/* FindPreBlockBoundary()
+ *
+ * Find the end of the <pre> block that starts at a given position of the
+ * text of a PreBlockIterator: the last line end within the block size, or
+ * the first one behind it when the first line is longer. A block never ends
+ * before an empty line, because a line feed right after a <pre> start tag
+ * is ignored by HTML parsers.
+ *
+ * Returns the position of the boundary or the text size when the rest of
+ * the text is a single block.
+ */
+unsigned int FindPreBlockBoundary(const PreBlockIterator *pIterator,
+                                  unsigned int blockStart)
+{
+    const char *pText = pIterator->pText;
+    unsigned int textSizeBytes = pIterator->textSizeBytes;
+    unsigned int blockSizeBytes = pIterator->blockSizeBytes;
+    unsigned int i;
+
+    if (blockSizeBytes == 0 || textSizeBytes - blockStart <= blockSizeBytes)
+    {
+        return textSizeBytes;
+    }
+
+    /* the boundary is behind a line feed that is followed by a character
+       other than a line end, the last possible one is the block size */
+    for (i = blockStart + blockSizeBytes; i > blockStart; i--)
+    {
+        if (pText[i - 1] == '\n' && pText[i] != '\n' && pText[i] != '\r')
+            return i;
+    }
+    for (i = blockStart + blockSizeBytes + 1; i < textSizeBytes; i++)
+    {
+        if (pText[i - 1] == '\n' && pText[i] != '\n' && pText[i] != '\r')
+            return i;
+    }
+
+    return textSizeBytes;
+}
+
+/* InitPreBlockIterator()
+ *
+ * Initialize a PreBlockIterator for a text, an optional FormatInfo structure
+ * with the tags of the text and the <pre> tags around it with their block
+ * size (see InitPreTags()). The text must stay valid while the iterator is
+ * used.
+ */
+void InitPreBlockIterator(PreBlockIterator *pIterator, const char *pText,
+                          unsigned int textSizeBytes,
+                          const FormatInfo *pFormatInfo,
+                          const FormatInfoTag *pPreTags,
+                          unsigned int preBlockSizeBytes)
+{
+    InitFormatInfoIterator(&pIterator->tagIterator, pFormatInfo,
+        &pPreTags[0], 1, &pPreTags[1], 1);
+    pIterator->pText = pText;
+    pIterator->textSizeBytes = textSizeBytes;
+    pIterator->blockSizeBytes = preBlockSizeBytes;
+    pIterator->boundaryPos = FindPreBlockBoundary(pIterator, 0);
+    pIterator->boundaryTagIndex = 0;
+    pIterator->numberOfOpenTags = 0;
+    pIterator->numberOfExcessOpenTags = 0;
+    pIterator->yNextTag = NextFormatInfoTag(&pIterator->tagIterator,
+        &pIterator->nextTag);
+}
+
+/* NextPreBlockTag()
+ *
+ * Get the next tag of a PreBlockIterator: the tags of the FormatInfo
+ * structure and the <pre> tags in order and at each <pre> block boundary
+ * (after the closing tags at its position) the tags that close and reopen
+ * the open tags.
+ *
+ * Returns 1 when a tag was stored or 0 when there are no more tags.
+ */
+int NextPreBlockTag(PreBlockIterator *pIterator, FormatInfoTag *pTag)
+{
+    unsigned int numberOfOpenTags = pIterator->numberOfOpenTags;
+    unsigned int i;
+
+    if (!pIterator->yNextTag)
+        return 0;
+
+    /* a boundary before the next tag starts with closing the innermost open
+       tag (boundaries are within the <pre> tags, so there is an open tag) */
+    while (pIterator->boundaryTagIndex == 0 &&
+        pIterator->boundaryPos < pIterator->textSizeBytes &&
+        (pIterator->boundaryPos < pIterator->nextTag.bytePos ||
+        (pIterator->boundaryPos == pIterator->nextTag.bytePos &&
+        !pIterator->nextTag.yClose)))
+    {
+        if (pIterator->numberOfExcessOpenTags == 0)
+        {
+            pIterator->boundaryTagIndex = 1;
+        }
+        else
+        {
+            pIterator->boundaryPos = FindPreBlockBoundary(pIterator,
+                pIterator->boundaryPos);
+        }
+    }
+
+    if (pIterator->boundaryTagIndex != 0)
+    {
+        i = pIterator->boundaryTagIndex - 1;
+        if (i < numberOfOpenTags)
+        {
+            *pTag = pIterator->openTags[numberOfOpenTags - 1 - i];
+            pTag->yClose = 1;
+        }
+        else
+        {
+            *pTag = pIterator->openTags[i - numberOfOpenTags];
+        }
+        pTag->bytePos = pIterator->boundaryPos;
+
+        pIterator->boundaryTagIndex++;
+        if (pIterator->boundaryTagIndex > 2 * numberOfOpenTags)
+        {
+            pIterator->boundaryTagIndex = 0;
+            pIterator->boundaryPos = FindPreBlockBoundary(pIterator,
+                pIterator->boundaryPos);
+        }
+        return 1;
+    }
+
+    /* keep track of the open tags, a closing tag closes the innermost open
+       tag of its type */
+    *pTag = pIterator->nextTag;
+    if (!pTag->yClose)
+    {
+        if (numberOfOpenTags < PRE_BLOCK_MAX_OPEN_TAGS)
+            pIterator->openTags[pIterator->numberOfOpenTags++] = *pTag;
+        else
+            pIterator->numberOfExcessOpenTags++;
+    }
+    else if (pIterator->numberOfExcessOpenTags != 0)
+    {
+        pIterator->numberOfExcessOpenTags--;
+    }
+    else
+    {
+        for (i = numberOfOpenTags; i > 0; i--)
+        {
+            if (pIterator->openTags[i - 1].type == pTag->type)
+                break;
+        }
+        if (i > 0)
+        {
+            memmove(&pIterator->openTags[i - 1], &pIterator->openTags[i],
+                (numberOfOpenTags - i) * sizeof(FormatInfoTag));
+            pIterator->numberOfOpenTags--;
+        }
+    }
+
+    pIterator->yNextTag = NextFormatInfoTag(&pIterator->tagIterator,
+        &pIterator->nextTag);
+    return 1;
+}
+
+/* CalculateHtmlFragmentSize()
+ *
+ * Determine the size of the HTML code generated from a UTF8 input buffer and
+ * an optional FormatInfo structure (see GenerateHtmlFragmentInBuffer()): the
+ * escaped input text and the markup of the tags and of the given <pre> tags
+ * with their block size (see InitPreTags()), without prefix and suffix
+ * strings.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int CalculateHtmlFragmentSize(const char *pInputBuffer,
+                              unsigned int inputBufSizeBytes,
+                              const FormatInfo *pFormatInfo,
+                              const char *pCrlfTextStart,
+                              const FormatInfoTag *pPreTags,
+                              unsigned int preBlockSizeBytes,
+                              unsigned int *pHtmlSizeBytes, ErrBlock *pEb)
+{
+    PreBlockIterator iterator;
+    FormatInfoTag tag;
+    unsigned int htmlSizeBytes;
+    int retval;
+
+    /* sanity check: tags within the input? (they are sorted by design) */
+    if (pFormatInfo != NULL && pFormatInfo->lastBytePos > inputBufSizeBytes)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "FormatInfo tags exceed the input size");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    /* escaped input string (already UTF8) */
+    htmlSizeBytes = EscapeHtmlText(pInputBuffer, inputBufSizeBytes,
+        pCrlfTextStart, NULL);
+
+    /* generated HTML tags */
+    InitPreBlockIterator(&iterator, pInputBuffer, inputBufSizeBytes,
+        pFormatInfo, pPreTags, preBlockSizeBytes);
+    while (NextPreBlockTag(&iterator, &tag))
+    {
+        retval = GenerateHtmlMarkupFromFormatInfoTag(tag.type, tag.parameter,
+            tag.yClose, NULL, 0);
+        if (retval == -1)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "HTML tag space detection for tag type 0x%X with "
+                    "parameter 0x%X failed", tag.type, tag.parameter);
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 2;
+            }
+            return -1;
+        }
+        htmlSizeBytes += (unsigned int)retval;
+    }
+
+    *pHtmlSizeBytes = htmlSizeBytes;
+    return 0;
+}
+
+/* GenerateHtmlFragmentInBuffer()
+ *
+ * Generate HTML code in UTF8 (not zero terminated) from a UTF8 input buffer
+ * (does not need to be zero terminated) and an optional FormatInfo structure
+ * and store it in a retained buffer (see ReserveBuffer()), which grows in an
+ * arena. The escaped input text is enclosed in <pre> elements of the given
+ * block size (see InitPreTags()), optional prefix and suffix strings (may be
+ * NULL) are copied unchanged before and after it. Stores the size of the
+ * HTML code in an output variable. When the FormatInfo pointer is NULL
+ * no formatting is applied to the HTML output. When yCrlf is set line feeds
+ * of the input text are written as CR LF (see EscapeHtmlText()).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. The retained buffer stays owned by the caller in
+ * any case.
+ */
+int GenerateHtmlFragmentInBuffer(const char *pInputBuffer,
+                                 unsigned int inputBufSizeBytes,
+                                 const FormatInfo *pFormatInfo,
+                                 unsigned int yCrlf,
+                                 unsigned int preBlockSizeBytes,
+                                 const char *pPrefixString,
+                                 const char *pSuffixString,
+                                 Arena *pArena, char **ppHtmlBuffer,
+                                 unsigned int *pHtmlBufCapacityBytes,
+                                 unsigned int *pHtmlSizeBytes,
+                                 ErrBlock *pEb)
+{
+    char *pOutputBuffer;
+    const char *pCrlfTextStart = (yCrlf ? pInputBuffer : NULL);
+    PreBlockIterator iterator;
+    FormatInfoTag tag;
+    FormatInfoTag preTags[2];
+    unsigned int inputBytePos = 0;
+    unsigned int outputBufWriteIndex = 0;
+    unsigned int htmlSizeBytes;
+    int retval;
+    ErrBlock eb;
+
+    if (pPrefixString == NULL)
+        pPrefixString = "";
+    if (pSuffixString == NULL)
+        pSuffixString = "";
+
+    InitPreTags(preTags, inputBufSizeBytes, preBlockSizeBytes);
+
+    /* determine output size: escaped input string and generated HTML tags */
+    if (CalculateHtmlFragmentSize(pInputBuffer, inputBufSizeBytes,
+        pFormatInfo, pCrlfTextStart, preTags, preBlockSizeBytes,
+        &htmlSizeBytes, &eb))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "HTML size calculation failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 3;
+        }
+        return -1;
+    }
+
+    /* determine output size: fixed prefix and suffix */
+    htmlSizeBytes += strlen(pPrefixString) + strlen(pSuffixString);
+
+    /* allocate the output buffer */
+    if (ReserveBuffer(pArena, (void **)ppHtmlBuffer, pHtmlBufCapacityBytes,
+        htmlSizeBytes, NULL))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate buffer for HTML data");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 6;
+        }
+        return -1;
+    }
+    pOutputBuffer = *ppHtmlBuffer;
+
+    /* fill buffer: prefix */
+    retval = (int)strlen(pPrefixString);
+    memcpy(pOutputBuffer + outputBufWriteIndex, pPrefixString, retval);
+    outputBufWriteIndex += retval;
+
+    /* fill buffer: walk the sorted tags once, escaping the input text between
+       them (the closing <pre> tag is at the end of the input) */
+    InitPreBlockIterator(&iterator, pInputBuffer, inputBufSizeBytes,
+        pFormatInfo, preTags, preBlockSizeBytes);
+    while (NextPreBlockTag(&iterator, &tag))
+    {
+        outputBufWriteIndex += EscapeHtmlText(pInputBuffer + inputBytePos,
+            tag.bytePos - inputBytePos, pCrlfTextStart,
+            pOutputBuffer + outputBufWriteIndex);
+        inputBytePos = tag.bytePos;
+
+        retval = GenerateHtmlMarkupFromFormatInfoTag(tag.type, tag.parameter,
+            tag.yClose, pOutputBuffer + outputBufWriteIndex,
+            htmlSizeBytes - outputBufWriteIndex);
+        if (retval == -1)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "HTML tag generation for tag type 0x%X with "
+                    "parameter 0x%X failed", tag.type, tag.parameter);
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 8;
+            }
+            return -1;
+        }
+        outputBufWriteIndex += retval;
+    }
+
+    /* fill buffer: suffix */
+    retval = (int)strlen(pSuffixString);
+    memcpy(pOutputBuffer + outputBufWriteIndex, pSuffixString, retval);
+    outputBufWriteIndex += retval;
+
+    /* sanity check: buffer filled exactly to the end? */
+    if (outputBufWriteIndex != htmlSizeBytes)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Error in internal buffer size calculation");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 9;
+        }
+        return -1;
+    }
+
+    /* success */
+    *pHtmlSizeBytes = htmlSizeBytes;
+    return 0;
+}
+
+/* GenerateHtmlFragment()
+ *
+ * Generate HTML code like GenerateHtmlFragmentInBuffer() and store it in a
+ * buffer allocated from an arena. Stores the address of the allocated buffer
+ * (released with the arena) and the size of the allocated buffer in output
+ * variables.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. When an error occurrs the values of the output
+ * pointers are undefined.
+ */
+int GenerateHtmlFragment(const char *pInputBuffer,
+                         unsigned int inputBufSizeBytes,
+                         const FormatInfo *pFormatInfo,
+                         unsigned int yCrlf,
+                         unsigned int preBlockSizeBytes,
+                         const char *pPrefixString,
+                         const char *pSuffixString, Arena *pArena,
+                         char **ppAllocatedHtmlBuffer,
+                         unsigned int *pAllocatedHtmlBufSizeBytes,
+                         ErrBlock *pEb)
+{
+    char *pHtmlBuf = NULL;
+    unsigned int htmlBufCapacityBytes = 0;
+
+    if (GenerateHtmlFragmentInBuffer(pInputBuffer, inputBufSizeBytes,
+        pFormatInfo, yCrlf, preBlockSizeBytes, pPrefixString, pSuffixString,
+        pArena, &pHtmlBuf, &htmlBufCapacityBytes, pAllocatedHtmlBufSizeBytes,
+        pEb))
+    {
+        return -1;
+    }
+
+    /* success */
+    *ppAllocatedHtmlBuffer = pHtmlBuf;
+    return 0;
+}
+
+/* staging buffer size of an HtmlFileWriter, segments of at least half of it
+   are written directly from their own memory */
+#define HTML_WRITER_BUFFER_BYTES 65536
+
+/* writer that gathers the segments of CF_HTML data (strings, tag markup and
+   escaped text) in a fixed size staging buffer, so that the data is written
+   to a file without being concatenated in memory first */
+typedef struct
+{
+    HANDLE fileHandle;
+    char *pBuffer;
+    unsigned int bufferedBytes;
+    unsigned int totalBytes;
+} HtmlFileWriter;
+
+/* FlushHtmlFileWriter()
+ *
+ * Write the staging buffer of an HtmlFileWriter to its file.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int FlushHtmlFileWriter(HtmlFileWriter *pWriter, ErrBlock *pEb)
+{
+    if (WriteAllToFile(pWriter->fileHandle, pWriter->pBuffer,
+        pWriter->bufferedBytes, pEb))
+    {
+        return -1;
+    }
+    pWriter->bufferedBytes = 0;
+
+    return 0;
+}
+
+/* AppendToHtmlFileWriter()
+ *
+ * Append a segment of a given size to an HtmlFileWriter. Small segments are
+ * copied to the staging buffer, large segments are written directly after
+ * the buffered data.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int AppendToHtmlFileWriter(HtmlFileWriter *pWriter, const char *pSegment,
+                           unsigned int segmentSizeBytes, ErrBlock *pEb)
+{
+    if (segmentSizeBytes > HTML_WRITER_BUFFER_BYTES - pWriter->bufferedBytes
+        || segmentSizeBytes >= HTML_WRITER_BUFFER_BYTES / 2)
+    {
+        if (FlushHtmlFileWriter(pWriter, pEb))
+            return -1;
+    }
+    if (segmentSizeBytes >= HTML_WRITER_BUFFER_BYTES / 2)
+    {
+        if (WriteAllToFile(pWriter->fileHandle, pSegment, segmentSizeBytes,
+            pEb))
+        {
+            return -1;
+        }
+    }
+    else
+    {
+        memcpy(pWriter->pBuffer + pWriter->bufferedBytes, pSegment,
+            segmentSizeBytes);
+        pWriter->bufferedBytes += segmentSizeBytes;
+    }
+    pWriter->totalBytes += segmentSizeBytes;
+
+    return 0;
+}
+
+/* AppendEscapedToHtmlFileWriter()
+ *
+ * Escape UTF8 text (not zero terminated) into the staging buffer of an
+ * HtmlFileWriter (see EscapeHtmlText()), in chunks that fit into the free
+ * space of the buffer even if every character is replaced by the longest
+ * entity.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int AppendEscapedToHtmlFileWriter(HtmlFileWriter *pWriter,
+                                  const char *pInput,
+                                  unsigned int inputSizeBytes,
+                                  const char *pCrlfTextStart, ErrBlock *pEb)
+{
+    unsigned int chunkSizeBytes;
+    unsigned int escapedBytes;
+
+    while (inputSizeBytes != 0)
+    {
+        /* "&quot;" is the longest entity */
+        chunkSizeBytes = (HTML_WRITER_BUFFER_BYTES - pWriter->bufferedBytes) /
+            6;
+        if (chunkSizeBytes == 0)
+        {
+            if (FlushHtmlFileWriter(pWriter, pEb))
+                return -1;
+            continue;
+        }
+        if (chunkSizeBytes > inputSizeBytes)
+            chunkSizeBytes = inputSizeBytes;
+
+        escapedBytes = EscapeHtmlText(pInput, chunkSizeBytes, pCrlfTextStart,
+            pWriter->pBuffer + pWriter->bufferedBytes);
+        pWriter->bufferedBytes += escapedBytes;
+        pWriter->totalBytes += escapedBytes;
+        pInput += chunkSizeBytes;
+        inputSizeBytes -= chunkSizeBytes;
+    }
+
+    return 0;
+}
+
+/* WriteHtmlFragmentToHtmlFileWriter()
+ *
+ * Append the HTML code generated from a UTF8 input buffer and an optional
+ * FormatInfo structure (see GenerateHtmlFragmentInBuffer()) to an
+ * HtmlFileWriter, walking the sorted tags once and escaping the input text
+ * between them (the closing <pre> tag is at the end of the input).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int WriteHtmlFragmentToHtmlFileWriter(HtmlFileWriter *pWriter,
+                                      const char *pInputBuffer,
+                                      unsigned int inputBufSizeBytes,
+                                      const FormatInfo *pFormatInfo,
+                                      const char *pCrlfTextStart,
+                                      const FormatInfoTag *pPreTags,
+                                      unsigned int preBlockSizeBytes,
+                                      ErrBlock *pEb)
+{
+    char markup[64];
+    PreBlockIterator iterator;
+    FormatInfoTag tag;
+    unsigned int inputBytePos = 0;
+    int retval;
+
+    InitPreBlockIterator(&iterator, pInputBuffer, inputBufSizeBytes,
+        pFormatInfo, pPreTags, preBlockSizeBytes);
+    while (NextPreBlockTag(&iterator, &tag))
+    {
+        if (AppendEscapedToHtmlFileWriter(pWriter,
+            pInputBuffer + inputBytePos, tag.bytePos - inputBytePos,
+            pCrlfTextStart, pEb))
+        {
+            return -1;
+        }
+        inputBytePos = tag.bytePos;
+
+        retval = GenerateHtmlMarkupFromFormatInfoTag(tag.type, tag.parameter,
+            tag.yClose, markup, sizeof(markup));
+        if (retval == -1)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "HTML tag generation for tag type 0x%X with "
+                    "parameter 0x%X failed", tag.type, tag.parameter);
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 1;
+            }
+            return -1;
+        }
+        if (AppendToHtmlFileWriter(pWriter, markup, (unsigned int)retval,
+            pEb))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* WriteClipboardHtmlToFile()
+ *
+ * Write HTML code in the CF_HTML clipboard format (like
+ * GenerateClipboardHtml()) to a file handle without generating it in one
+ * buffer: the sizes are calculated first, then the start, the tag markup,
+ * the escaped text between the tags and the end are gathered in a fixed
+ * size staging buffer (see HtmlFileWriter), so the additional memory does
+ * not depend on the text size.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int WriteClipboardHtmlToFile(HANDLE fileHandle, const char *pInputBuffer,
+                             unsigned int inputBufSizeBytes,
+                             const FormatInfo *pFormatInfo,
+                             unsigned int yCrlf,
+                             unsigned int preBlockSizeBytes, ErrBlock *pEb)
+{
+    const char *pCrlfTextStart = (yCrlf ? pInputBuffer : NULL);
+    char *pHtmlStart;
+    Arena arena;
+    HtmlFileWriter writer;
+    FormatInfoTag preTags[2];
+    unsigned int styleClasses;
+    unsigned int htmlStartSizeBytes;
+    unsigned int fragmentSizeBytes;
+    unsigned int htmlSizeBytes;
+    int retval;
+    ErrBlock eb;
+
+    InitPreTags(preTags, inputBufSizeBytes, preBlockSizeBytes);
+    if (CalculateHtmlFragmentSize(pInputBuffer, inputBufSizeBytes,
+        pFormatInfo, pCrlfTextStart, preTags, preBlockSizeBytes,
+        &fragmentSizeBytes, &eb))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "HTML size calculation failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    /* the start is small, it is generated in its own buffer because its
+       description needs the total size */
+    styleClasses = GetFormatInfoStyleClasses(pFormatInfo, preBlockSizeBytes);
+    htmlStartSizeBytes = GenerateClipboardHtmlStart(styleClasses, NULL);
+    htmlSizeBytes = htmlStartSizeBytes + fragmentSizeBytes +
+        (unsigned int)strlen(clipboardHtmlEndString);
+    InitArena(&arena);
+    pHtmlStart = ArenaAlloc(&arena, htmlStartSizeBytes);
+    writer.pBuffer = ArenaAlloc(&arena, HTML_WRITER_BUFFER_BYTES);
+    if (pHtmlStart == NULL || writer.pBuffer == NULL)
+    {
+        FreeArena(&arena);
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate buffers for HTML data");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        return -1;
+    }
+    GenerateClipboardHtmlStart(styleClasses, pHtmlStart);
+    FillClipboardHtmlDescription(pHtmlStart, htmlSizeBytes,
+        htmlStartSizeBytes);
+    writer.fileHandle = fileHandle;
+    writer.bufferedBytes = 0;
+    writer.totalBytes = 0;
+
+    retval = AppendToHtmlFileWriter(&writer, pHtmlStart, htmlStartSizeBytes,
+        &eb);
+    if (retval == 0)
+    {
+        retval = WriteHtmlFragmentToHtmlFileWriter(&writer, pInputBuffer,
+            inputBufSizeBytes, pFormatInfo, pCrlfTextStart, preTags,
+            preBlockSizeBytes, &eb);
+    }
+    if (retval == 0)
+    {
+        retval = AppendToHtmlFileWriter(&writer, clipboardHtmlEndString,
+            (unsigned int)strlen(clipboardHtmlEndString), &eb);
+    }
+    if (retval == 0)
+        retval = FlushHtmlFileWriter(&writer, &eb);
+    FreeArena(&arena);
+    if (retval != 0)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Writing HTML data failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 3;
+        }
+        return -1;
+    }
+
+    /* sanity check: exactly the size in the description written? */
+    if (writer.totalBytes != htmlSizeBytes)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Error in internal HTML size calculation");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 4;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/* GenerateClipboardHtml()
+ *
+ * Generate HTML code in the CF_HTML clipboard format (not zero terminated)
+ * from a UTF8 input buffer (does not need to be zero terminated) and an
+ * optional FormatInfo structure and store it in a buffer allocated from an
+ * arena. Stores the address of the allocated buffer (released with the
+ * arena) and the size of the allocated buffer in output variables. When the
+ * FormatInfo pointer is NULL no formatting is applied to the HTML output.
+ * When yCrlf is set line feeds are written as CR LF. The text is split into
+ * <pre> elements of the given block size (see InitPreTags()).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. When an error occurrs the values of the output
+ * pointers are undefined.
+ */
+int GenerateClipboardHtml(const char *pInputBuffer,
+                          unsigned int inputBufSizeBytes,
+                          const FormatInfo *pFormatInfo,
+                          unsigned int yCrlf,
+                          unsigned int preBlockSizeBytes, Arena *pArena,
+                          char **ppAllocatedHtmlBuffer,
+                          unsigned int *pAllocatedHtmlBufSizeBytes,
+                          ErrBlock *pEb)
+{
+    char *pHtmlStart;
+    unsigned int styleClasses;
+    unsigned int htmlStartSizeBytes;
+    int retval;
+
+    styleClasses = GetFormatInfoStyleClasses(pFormatInfo, preBlockSizeBytes);
+    htmlStartSizeBytes = GenerateClipboardHtmlStart(styleClasses, NULL);
+    pHtmlStart = ArenaAlloc(pArena, htmlStartSizeBytes + 1);
+    if (pHtmlStart == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate buffer for HTML start");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+    GenerateClipboardHtmlStart(styleClasses, pHtmlStart);
+    pHtmlStart[htmlStartSizeBytes] = '\0';
+
+    retval = GenerateHtmlFragment(pInputBuffer, inputBufSizeBytes,
+        pFormatInfo, yCrlf, preBlockSizeBytes, pHtmlStart,
+        clipboardHtmlEndString, pArena, ppAllocatedHtmlBuffer,
+        pAllocatedHtmlBufSizeBytes, pEb);
+    if (retval != 0)
+        return -1;
+
+    FillClipboardHtmlDescription(*ppAllocatedHtmlBuffer,
+        *pAllocatedHtmlBufSizeBytes, htmlStartSizeBytes);
+    return 0;
+}
+
+/* GenerateClipboardHtmlFromFragments()
+ *
+ * Concatenate HTML fragments (as generated by GenerateHtmlFragment() without
+ * prefix and suffix) in the given order and store them in the CF_HTML
+ * clipboard format (not zero terminated) in an allocated buffer. The CSS
+ * classes used by the fragments are given as a bit mask (see
+ * GetFormatInfoStyleClasses()). The buffer is allocated from an arena.
+ * Stores the address of the allocated buffer (released with the arena) and
+ * the size of the allocated buffer in output variables.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. When an error occurrs the values of the output
+ * pointers are undefined.
+ */
+int GenerateClipboardHtmlFromFragments(const char **ppFragments,
+                                       const unsigned int *pFragmentSizes,
+                                       unsigned int numberOfFragments,
+                                       unsigned int styleClasses,
+                                       Arena *pArena,
+                                       char **ppAllocatedHtmlBuffer,
+                                       unsigned int *pAllocatedHtmlBufSizeBytes,
+                                       ErrBlock *pEb)
+{
+    char *pOutputBuffer;
+    unsigned int htmlSizeBytes;
+    unsigned int htmlStartSizeBytes;
+    unsigned int outputBufWriteIndex = 0;
+    unsigned int i;
+
+    htmlStartSizeBytes = GenerateClipboardHtmlStart(styleClasses, NULL);
+    htmlSizeBytes = htmlStartSizeBytes +
+        (unsigned int)strlen(clipboardHtmlEndString);
+    for (i = 0; i < numberOfFragments; i++)
+        htmlSizeBytes += pFragmentSizes[i];
+
+    pOutputBuffer = ArenaAlloc(pArena, htmlSizeBytes);
+    if (pOutputBuffer == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate buffer for HTML data");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    outputBufWriteIndex += GenerateClipboardHtmlStart(styleClasses,
+        pOutputBuffer);
+    for (i = 0; i < numberOfFragments; i++)
+    {
+        memcpy(pOutputBuffer + outputBufWriteIndex, ppFragments[i],
+            pFragmentSizes[i]);
+        outputBufWriteIndex += pFragmentSizes[i];
+    }
+    memcpy(pOutputBuffer + outputBufWriteIndex, clipboardHtmlEndString,
+        strlen(clipboardHtmlEndString));
+
+    FillClipboardHtmlDescription(pOutputBuffer, htmlSizeBytes,
+        htmlStartSizeBytes);
+
+    /* success */
+    *ppAllocatedHtmlBuffer = pOutputBuffer;
+    *pAllocatedHtmlBufSizeBytes = htmlSizeBytes;
+    return 0;
+}
+
+/* ExtractFormatInfoFromAnsiEscape()
+ *
+ * TODO ExtractFormatInfoFromAnsiEscape() documentation
+ */
+int ExtractFormatInfoFromAnsiEscape(const char *pInputBuffer,
+                                    unsigned int inputBufSizeBytes,
+                                    FormatInfo **ppAllocatedFormatInfo,
+                                    char **ppAllocatedUtf8Buffer,
+                                    unsigned int *pAllocatedBufSizeBytes,
+                                    ErrBlock *pEb)
+{
+    //TODO implement ExtractFormatInfoFromAnsiEscape()
+}
+
+/* character classes of the highlighting lexers */
+enum
+{
+    CC_OTHER,
+    CC_ALPHA,       /* letters, '_' and all non-ASCII UTF8 bytes */
+    CC_DIGIT,
+    CC_SPACE,       /* space, tab, vertical tab, form feed */
+    CC_NEWLINE,
+    CC_CR,
+    CC_DQUOTE,
+    CC_SQUOTE,
+    CC_SLASH,
+    CC_STAR,
+    CC_BACKSLASH,
+    CC_HASH,
+    CC_TIMESEP,     /* ':', '-', '.' and ',' */
+    NUMBER_OF_CHAR_CLASSES
+};
+
+/* character class of each byte (index = byte value) */
+static const unsigned char highlightCharClasses[256] =
+{
+    /* 0x00 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  3,  4,  3,  3,  5,  0,  0,
+    /* 0x10 */  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    /* 0x20 */  3,  0,  6, 11,  0,  0,  0,  7,  0,  0,  9,  0, 12, 12, 12,  8,
+    /* 0x30 */  2,  2,  2,  2,  2,  2,  2,  2,  2,  2, 12,  0,  0,  0,  0,  0,
+    /* 0x40 */  0,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+    /* 0x50 */  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  0, 10,  0,  0,  1,
+    /* 0x60 */  0,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+    /* 0x70 */  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  0,  0,  0,  0,  0,
+    /* 0x80 */  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+    /* 0x90 */  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+    /* 0xA0 */  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+    /* 0xB0 */  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+    /* 0xC0 */  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+    /* 0xD0 */  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+    /* 0xE0 */  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+    /* 0xF0 */  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1
+};
+
+/* tokens recognized by the highlighting lexers */
+enum
+{
+    TOKEN_NONE,
+    TOKEN_IDENT,
+    TOKEN_STRING,
+    TOKEN_COMMENT,
+    TOKEN_PREPROC,
+    TOKEN_NUMBER,
+    TOKEN_LINE
+};
+
+/* C/C++ lexer: states, token of each state and state transitions */
+enum
+{
+    CS_LINE_START, CS_NORMAL, CS_IDENT, CS_NUMBER, CS_STRING, CS_STRING_ESC,
+    CS_STRING_END, CS_CHAR, CS_CHAR_ESC, CS_SLASH, CS_LINE_COMMENT,
+    CS_BLOCK_COMMENT, CS_BLOCK_STAR, CS_BLOCK_END, CS_PREPROC,
+    CS_PREPROC_ESC
+};
+static const unsigned char cLexerTokens[] =
+{
+    TOKEN_NONE, TOKEN_NONE, TOKEN_IDENT, TOKEN_NONE, TOKEN_STRING,
+    TOKEN_STRING, TOKEN_STRING, TOKEN_STRING, TOKEN_STRING, TOKEN_COMMENT,
+    TOKEN_COMMENT, TOKEN_COMMENT, TOKEN_COMMENT, TOKEN_COMMENT,
+    TOKEN_PREPROC, TOKEN_PREPROC
+};
+static const unsigned char cLexerTransitions[][NUMBER_OF_CHAR_CLASSES] =
+{
+    /*                 oth alp dig spc  nl  cr  dq  sq  sl  st  bs hsh tsp */
+    /* LINE_START */  {  1,  2,  3,  0,  0,  0,  4,  7,  9,  1,  1, 14,  1},
+    /* NORMAL */      {  1,  2,  3,  1,  0,  1,  4,  7,  9,  1,  1,  1,  1},
+    /* IDENT */       {  1,  2,  2,  1,  0,  1,  4,  7,  9,  1,  1,  1,  1},
+    /* NUMBER */      {  1,  3,  3,  1,  0,  1,  4,  7,  9,  1,  1,  1,  3},
+    /* STRING */      {  4,  4,  4,  4,  0,  4,  6,  4,  4,  4,  5,  4,  4},
+    /* STRING_ESC */  {  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4},
+    /* STRING_END */  {  1,  2,  3,  1,  0,  1,  4,  7,  9,  1,  1,  1,  1},
+    /* CHAR */        {  7,  7,  7,  7,  0,  7,  7,  6,  7,  7,  8,  7,  7},
+    /* CHAR_ESC */    {  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7},
+    /* SLASH */       {  1,  2,  3,  1,  0,  1,  4,  7, 10, 11,  1,  1,  1},
+    /* LINE_COMM. */  { 10, 10, 10, 10,  0, 10, 10, 10, 10, 10, 10, 10, 10},
+    /* BLOCK_COMM. */ { 11, 11, 11, 11, 11, 11, 11, 11, 11, 12, 11, 11, 11},
+    /* BLOCK_STAR */  { 11, 11, 11, 11, 11, 11, 11, 11, 13, 12, 11, 11, 11},
+    /* BLOCK_END */   {  1,  2,  3,  1,  0,  1,  4,  7,  9,  1,  1,  1,  1},
+    /* PREPROC */     { 14, 14, 14, 14,  0, 14, 14, 14, 14, 14, 15, 14, 14},
+    /* PREPROC_ESC */ { 14, 14, 14, 14, 14, 15, 14, 14, 14, 14, 14, 14, 14}
+};
+
+/* sorted keywords of C and C++ */
+static const char *cKeywords[] =
+{
+    "auto", "bool", "break", "case", "catch", "char", "class", "const",
+    "continue", "default", "delete", "do", "double", "else", "enum",
+    "extern", "false", "float", "for", "goto", "if", "inline", "int", "long",
+    "namespace", "new", "nullptr", "operator", "private", "protected",
+    "public", "register", "return", "short", "signed", "sizeof", "static",
+    "struct", "switch", "template", "this", "throw", "true", "try",
+    "typedef", "typename", "union", "unsigned", "using", "virtual", "void",
+    "volatile", "while"
+};
+
+/* log lexer: words (level keywords) and numbers (timestamp candidates) */
+enum
+{
+    LS_NORMAL, LS_WORD, LS_NUMBER
+};
+static const unsigned char logLexerTokens[] =
+{
+    TOKEN_NONE, TOKEN_IDENT, TOKEN_NUMBER
+};
+static const unsigned char logLexerTransitions[][NUMBER_OF_CHAR_CLASSES] =
+{
+    /*                 oth alp dig spc  nl  cr  dq  sq  sl  st  bs hsh tsp */
+    /* NORMAL */      {  0,  1,  2,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0},
+    /* WORD */        {  0,  1,  1,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0},
+    /* NUMBER */      {  0,  2,  2,  0,  0,  0,  0,  0,  2,  0,  0,  0,  2}
+};
+
+/* log level keywords and the tags applied to them */
+static const struct
+{
+    const char *pKeyword;
+    TagType tagTypes[2];
+    unsigned int numberOfTagTypes;
+} logLevelKeywords[] =
+{
+    {"FATAL", {TagTypeBold, TagTypeFgRed}, 2},
+    {"CRITICAL", {TagTypeBold, TagTypeFgRed}, 2},
+    {"CRIT", {TagTypeBold, TagTypeFgRed}, 2},
+    {"SEVERE", {TagTypeBold, TagTypeFgRed}, 2},
+    {"ERROR", {TagTypeBold, TagTypeFgRed}, 2},
+    {"ERR", {TagTypeBold, TagTypeFgRed}, 2},
+    {"WARNING", {TagTypeFgYellow}, 1},
+    {"WARN", {TagTypeFgYellow}, 1},
+    {"NOTICE", {TagTypeFgGreen}, 1},
+    {"INFO", {TagTypeFgGreen}, 1},
+    {"DEBUG", {TagTypeFgGray}, 1},
+    {"TRACE", {TagTypeFgGray}, 1},
+    {"VERBOSE", {TagTypeFgGray}, 1}
+};
+
+/* unified diff lexer: every line is a token */
+enum
+{
+    DS_LINE_START, DS_LINE, DS_LINE_CR
+};
+static const unsigned char diffLexerTokens[] =
+{
+    TOKEN_NONE, TOKEN_LINE, TOKEN_NONE
+};
+static const unsigned char diffLexerTransitions[][NUMBER_OF_CHAR_CLASSES] =
+{
+    /*                 oth alp dig spc  nl  cr  dq  sq  sl  st  bs hsh tsp */
+    /* LINE_START */  {  1,  1,  1,  1,  0,  0,  1,  1,  1,  1,  1,  1,  1},
+    /* LINE */        {  1,  1,  1,  1,  0,  2,  1,  1,  1,  1,  1,  1,  1},
+    /* LINE_CR */     {  1,  1,  1,  1,  0,  2,  1,  1,  1,  1,  1,  1,  1}
+};
+
+/* StartsWith()
+ *
+ * Returns 1 if a string (not zero terminated) starts with a given zero
+ * terminated prefix, 0 otherwise.
+ */
+unsigned int StartsWith(const char *pString, unsigned int stringSizeBytes,
+                        const char *pPrefix)
+{
+    unsigned int prefixSizeBytes = (unsigned int)strlen(pPrefix);
+
+    return (stringSizeBytes >= prefixSizeBytes &&
+        memcmp(pString, pPrefix, prefixSizeBytes) == 0);
+}
+
+/* ClassifyHighlightToken()
+ *
+ * Decide how a token found by one of the lexers is formatted. Stores up to
+ * two tag types in an output array.
+ *
+ * Returns the number of tag types (0 if the token is not formatted).
+ */
+unsigned int ClassifyHighlightToken(HighlightLanguage language,
+                                    unsigned int token, const char *pToken,
+                                    unsigned int tokenSizeBytes,
+                                    TagType *pTagTypes)
+{
+    unsigned int i;
+
+    if (language == HighlightLanguageC)
+    {
+        if (token == TOKEN_IDENT)
+        {
+            /* binary search in the sorted keyword list */
+            int low = 0;
+            int high = sizeof(cKeywords) / sizeof(cKeywords[0]) - 1;
+            while (low <= high)
+            {
+                int middle = (low + high) / 2;
+                int cmp = strncmp(cKeywords[middle], pToken, tokenSizeBytes);
+                if (cmp == 0 && cKeywords[middle][tokenSizeBytes] != '\0')
+                    cmp = 1;
+                if (cmp == 0)
+                {
+                    pTagTypes[0] = TagTypeFgBlue;
+                    return 1;
+                }
+                if (cmp < 0)
+                    low = middle + 1;
+                else
+                    high = middle - 1;
+            }
+            return 0;
+        }
+        if (token == TOKEN_STRING)
+        {
+            pTagTypes[0] = TagTypeFgRed;
+            return 1;
+        }
+        if (token == TOKEN_COMMENT && tokenSizeBytes >= 2)
+        {
+            /* a single '/' is a division, not a comment */
+            pTagTypes[0] = TagTypeFgGreen;
+            return 1;
+        }
+        if (token == TOKEN_PREPROC)
+        {
+            pTagTypes[0] = TagTypeFgMagenta;
+            return 1;
+        }
+    }
+    else if (language == HighlightLanguageLog)
+    {
+        if (token == TOKEN_IDENT)
+        {
+            for (i = 0; i < sizeof(logLevelKeywords) /
+                sizeof(logLevelKeywords[0]); i++)
+            {
+                if (strlen(logLevelKeywords[i].pKeyword) == tokenSizeBytes &&
+                    memcmp(logLevelKeywords[i].pKeyword, pToken,
+                    tokenSizeBytes) == 0)
+                {
+                    pTagTypes[0] = logLevelKeywords[i].tagTypes[0];
+                    pTagTypes[1] = logLevelKeywords[i].tagTypes[1];
+                    return logLevelKeywords[i].numberOfTagTypes;
+                }
+            }
+            return 0;
+        }
+        if (token == TOKEN_NUMBER)
+        {
+            /* timestamps: a date like 2013-12-31 or 2013/12/31 or a time
+               like 23:59 (anything after that is accepted) */
+            if (tokenSizeBytes >= 10 &&
+                (pToken[4] == '-' || pToken[4] == '/') &&
+                pToken[7] == pToken[4])
+            {
+                pTagTypes[0] = TagTypeFgBlue;
+                return 1;
+            }
+            for (i = 1; i + 2 < tokenSizeBytes; i++)
+            {
+                if (pToken[i] == ':' &&
+                    highlightCharClasses[(unsigned char)pToken[i - 1]] ==
+                        CC_DIGIT &&
+                    highlightCharClasses[(unsigned char)pToken[i + 1]] ==
+                        CC_DIGIT &&
+                    highlightCharClasses[(unsigned char)pToken[i + 2]] ==
+                        CC_DIGIT)
+                {
+                    pTagTypes[0] = TagTypeFgBlue;
+                    return 1;
+                }
+            }
+            return 0;
+        }
+    }
+    else if (language == HighlightLanguageDiff && token == TOKEN_LINE)
+    {
+        if (StartsWith(pToken, tokenSizeBytes, "+++") ||
+            StartsWith(pToken, tokenSizeBytes, "---") ||
+            StartsWith(pToken, tokenSizeBytes, "diff ") ||
+            StartsWith(pToken, tokenSizeBytes, "index "))
+        {
+            pTagTypes[0] = TagTypeBold;
+            return 1;
+        }
+        if (StartsWith(pToken, tokenSizeBytes, "@@"))
+        {
+            pTagTypes[0] = TagTypeFgBlue;
+            return 1;
+        }
+        if (pToken[0] == '+')
+        {
+            pTagTypes[0] = TagTypeFgGreen;
+            return 1;
+        }
+        if (pToken[0] == '-')
+        {
+            pTagTypes[0] = TagTypeFgRed;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* AppendHighlightTags()
+ *
+ * Run a table driven lexer for a given language over a UTF8 input buffer
+ * (does not need to be zero terminated) in one linear pass and append tags
+ * for the highlighted tokens to a FormatInfo structure (which should be
+ * empty).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int AppendHighlightTags(const char *pInputBuffer,
+                        unsigned int inputBufSizeBytes,
+                        HighlightLanguage language, FormatInfo *pFormatInfo,
+                        ErrBlock *pEb)
+{
+    const unsigned char (*pTransitions)[NUMBER_OF_CHAR_CLASSES];
+    const unsigned char *pStateTokens;
+    unsigned int state = 0;
+    unsigned int runToken = TOKEN_NONE;
+    unsigned int runStart = 0;
+    unsigned int i;
+    int retval = 0;
+
+    if (language == HighlightLanguageC)
+    {
+        pTransitions = cLexerTransitions;
+        pStateTokens = cLexerTokens;
+    }
+    else if (language == HighlightLanguageLog)
+    {
+        pTransitions = logLexerTransitions;
+        pStateTokens = logLexerTokens;
+    }
+    else if (language == HighlightLanguageDiff)
+    {
+        pTransitions = diffLexerTransitions;
+        pStateTokens = diffLexerTokens;
+    }
+    else
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Unsupported highlighting language %d", (int)language);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    /* one pass over the input; the end of the input ends the last token */
+    for (i = 0; i <= inputBufSizeBytes && retval == 0; i++)
+    {
+        unsigned int token = TOKEN_NONE;
+
+        if (i < inputBufSizeBytes)
+        {
+            state = pTransitions[state][
+                highlightCharClasses[(unsigned char)pInputBuffer[i]]];
+            token = pStateTokens[state];
+        }
+
+        if (token != runToken)
+        {
+            if (runToken != TOKEN_NONE)
+            {
+                TagType tagTypes[2];
+                unsigned int numberOfTagTypes;
+                unsigned int j;
+
+                numberOfTagTypes = ClassifyHighlightToken(language, runToken,
+                    pInputBuffer + runStart, i - runStart, tagTypes);
+                for (j = 0; j < numberOfTagTypes && retval == 0; j++)
+                {
+                    retval = AppendFormatInfoTag(pFormatInfo, runStart,
+                        tagTypes[j], 0, 0);
+                }
+                for (j = numberOfTagTypes; j > 0 && retval == 0; j--)
+                {
+                    retval = AppendFormatInfoTag(pFormatInfo, i,
+                        tagTypes[j - 1], 0, 1);
+                }
+            }
+            runToken = token;
+            runStart = i;
+        }
+    }
+
+    if (retval != 0)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate buffer for FormatInfo structure");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/* HighlightText()
+ *
+ * Create a FormatInfo structure with tags for the highlighted tokens of a
+ * UTF8 input buffer (see AppendHighlightTags()) in an arena. Stores the
+ * address of the allocated FormatInfo structure (released with the arena) in
+ * an output variable.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description. When an error occurrs the value of the output
+ * pointer is undefined.
+ */
+int HighlightText(const char *pInputBuffer, unsigned int inputBufSizeBytes,
+                  HighlightLanguage language, Arena *pArena,
+                  FormatInfo **ppAllocatedFormatInfo, ErrBlock *pEb)
+{
+    FormatInfo *pFormatInfo;
+
+    pFormatInfo = CreateFormatInfo(pArena);
+    if (pFormatInfo == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate FormatInfo structure");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        return -1;
+    }
+
+    if (AppendHighlightTags(pInputBuffer, inputBufSizeBytes, language,
+        pFormatInfo, pEb))
+    {
+        return -1;
+    }
+
+    /* success */
+    *ppAllocatedFormatInfo = pFormatInfo;
+    return 0;
+}
+
+/* rendering state of one input file in multi-file mode */
+typedef struct InputFileJob_
+{
+    const char *pFileName;
+    wchar_t *pTextHeader;
+    wchar_t *pWideCharBuf;
+    unsigned int wideCharBufSizeBytes;
+    char *pHtmlFragment;
+    unsigned int htmlFragmentSizeBytes;
+    unsigned int styleClasses;
+    Arena arena;        /* text header, text and HTML fragment */
+    int retval;
+    ErrBlock eb;
+} InputFileJob;
+
+/* list of input files shared by the worker threads */
+typedef struct InputFileJobList_
+{
+    InputFileJob *pJobs;
+    unsigned int numberOfJobs;
+    unsigned int codepage;
+    unsigned int yDetectCodepage;
+    unsigned int bufferSizeStep;
+    const LineSelection *pLineSelection;
+    const LineFilter *pLineFilter;
+    HighlightLanguage highlightLanguage;
+    unsigned int yCrlf;
+    unsigned int preBlockSizeBytes;
+    volatile LONG nextJobIndex;
+    Arena arena;        /* job array and output bookkeeping */
+} InputFileJobList;
+
+/* RenderInputFile()
+ *
+ * Read one input file (or its selected lines when the line selection pointer
+ * is not NULL, see ReadFileLinesToNewBuffer()), keep only the lines matching
+ * the line filter when its pointer is not NULL (see FilterLinesToNewBuffer()),
+ * convert it to UTF8 and generate its wide character text (without a header)
+ * and its HTML fragment (with the file name as a header, split into <pre>
+ * elements of the given block size, see InitPreTags()). The text header
+ * is generated separately so that the caller can concatenate the text of all
+ * files in order. All results are stored in the job structure and taken from
+ * the arena of the job (see FreeInputFileJobList()), temporary buffers are
+ * taken from a scratch arena. The caller releases both arenas in any case.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error the
+ * error block of the job is filled with an error description.
+ */
+int RenderInputFile(InputFileJob *pJob, Arena *pScratchArena,
+                    unsigned int codepage,
+                    unsigned int yDetectCodepage, unsigned int bufferSizeStep,
+                    const LineSelection *pLineSelection,
+                    const LineFilter *pLineFilter,
+                    HighlightLanguage highlightLanguage, unsigned int yCrlf,
+                    unsigned int preBlockSizeBytes)
+{
+    HANDLE fileHandle;
+    ErrBlock eb;
+    FormatInfo *pFormatInfo = NULL;
+    char *pInputBuffer;
+    char *pUtf8Buf;
+    char *pFileNameUtf8;
+    char *pHtmlPrefix;
+    char *pTextHeaderUtf8;
+    unsigned int totalReadBytes;
+    unsigned int utf8SizeBytes;
+    unsigned int fileNameUtf8SizeBytes;
+    unsigned int escapedFileNameSizeBytes;
+    unsigned int textHeaderSizeBytes;
+    unsigned int bomSizeBytes = 0;
+    int retval;
+
+    fileHandle = CreateFile(pJob->pFileName, GENERIC_READ, FILE_SHARE_READ,
+        NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+        snprintf(pJob->eb.errDescription, sizeof(pJob->eb.errDescription),
+            "Could not open file \"%s\", GetLastError() = 0x%X",
+            pJob->pFileName, GetLastError());
+        pJob->eb.errDescription[sizeof(pJob->eb.errDescription) - 1] = '\0';
+        pJob->eb.functionSpecificErrorCode = 1;
+        return -1;
+    }
+
+    retval = ReadFileLinesToNewBuffer(fileHandle, bufferSizeStep,
+        pLineSelection, pScratchArena, &pInputBuffer, &totalReadBytes, &eb);
+    CloseHandle(fileHandle);
+    if (retval != 0)
+    {
+        snprintf(pJob->eb.errDescription, sizeof(pJob->eb.errDescription),
+            "Reading file \"%s\" failed (%s)", pJob->pFileName,
+            eb.errDescription);
+        pJob->eb.errDescription[sizeof(pJob->eb.errDescription) - 1] = '\0';
+        pJob->eb.functionSpecificErrorCode = 2;
+        return -1;
+    }
+
+    if (yDetectCodepage)
+    {
+        codepage = DetectInputCodepage(pInputBuffer, totalReadBytes, codepage,
+            &bomSizeBytes);
+    }
+
+    /* lines are selected at single line feed bytes, which splits UTF16
+       characters */
+    if (pLineSelection != NULL &&
+        (codepage == CODEPAGE_UTF16LE || codepage == CODEPAGE_UTF16BE))
+    {
+        snprintf(pJob->eb.errDescription, sizeof(pJob->eb.errDescription),
+            "Line selections do not support UTF16 input (file \"%s\")",
+            pJob->pFileName);
+        pJob->eb.errDescription[sizeof(pJob->eb.errDescription) - 1] = '\0';
+        pJob->eb.functionSpecificErrorCode = 10;
+        return -1;
+    }
+
+    if (pLineFilter != NULL)
+    {
+        char *pFilteredBuffer;
+
+        retval = FilterLinesToNewBuffer(pInputBuffer + bomSizeBytes,
+            totalReadBytes - bomSizeBytes, codepage, pLineFilter,
+            pScratchArena, &pFilteredBuffer, &totalReadBytes, &eb);
+        if (retval != 0)
+        {
+            snprintf(pJob->eb.errDescription, sizeof(pJob->eb.errDescription),
+                "Filtering file \"%s\" failed (%s)", pJob->pFileName,
+                eb.errDescription);
+            pJob->eb.errDescription[
+                sizeof(pJob->eb.errDescription) - 1] = '\0';
+            pJob->eb.functionSpecificErrorCode = 9;
+            return -1;
+        }
+        pInputBuffer = pFilteredBuffer;
+        bomSizeBytes = 0;
+    }
+
+    if (codepage == CP_UTF8)
+    {
+        memmove(pInputBuffer, pInputBuffer + bomSizeBytes,
+            totalReadBytes - bomSizeBytes);
+        pUtf8Buf = pInputBuffer;
+        utf8SizeBytes = totalReadBytes - bomSizeBytes;
+    }
+    else
+    {
+        retval = ConvToUtf8NewBuffer(pInputBuffer + bomSizeBytes,
+            totalReadBytes - bomSizeBytes, codepage, pScratchArena, &pUtf8Buf,
+            &utf8SizeBytes, &eb);
+        if (retval != 0)
+        {
+            snprintf(pJob->eb.errDescription, sizeof(pJob->eb.errDescription),
+                "Converting file \"%s\" failed (%s)", pJob->pFileName,
+                eb.errDescription);
+            pJob->eb.errDescription[
+                sizeof(pJob->eb.errDescription) - 1] = '\0';
+            pJob->eb.functionSpecificErrorCode = 3;
+            return -1;
+        }
+    }
+
+    /* file names on the command line are in the ANSI codepage */
+    retval = ConvToUtf8NewBuffer(pJob->pFileName,
+        (unsigned int)strlen(pJob->pFileName), CP_ACP, pScratchArena,
+        &pFileNameUtf8, &fileNameUtf8SizeBytes, &eb);
+    if (retval != 0)
+    {
+        snprintf(pJob->eb.errDescription, sizeof(pJob->eb.errDescription),
+            "Converting file name \"%s\" failed (%s)", pJob->pFileName,
+            eb.errDescription);
+        pJob->eb.errDescription[sizeof(pJob->eb.errDescription) - 1] = '\0';
+        pJob->eb.functionSpecificErrorCode = 4;
+        return -1;
+    }
+
+    /* headers: "==> name <==" in the text and an underlined name in HTML */
+    textHeaderSizeBytes = fileNameUtf8SizeBytes + 10;
+    escapedFileNameSizeBytes = EscapeHtmlText(pFileNameUtf8,
+        fileNameUtf8SizeBytes, NULL, NULL);
+    pTextHeaderUtf8 = ArenaAlloc(pScratchArena, textHeaderSizeBytes + 1);
+    pHtmlPrefix = ArenaAlloc(pScratchArena, escapedFileNameSizeBytes + 15);
+    if (pTextHeaderUtf8 == NULL || pHtmlPrefix == NULL)
+    {
+        snprintf(pJob->eb.errDescription, sizeof(pJob->eb.errDescription),
+            "Could not allocate header buffers for file \"%s\"",
+            pJob->pFileName);
+        pJob->eb.errDescription[sizeof(pJob->eb.errDescription) - 1] = '\0';
+        pJob->eb.functionSpecificErrorCode = 6;
+        return -1;
+    }
+    snprintf(pTextHeaderUtf8, textHeaderSizeBytes + 1, "==> %s <==\r\n",
+        pFileNameUtf8);
+    memcpy(pHtmlPrefix, "<p><u>", 6);
+    EscapeHtmlText(pFileNameUtf8, fileNameUtf8SizeBytes, NULL,
+        pHtmlPrefix + 6);
+    memcpy(pHtmlPrefix + 6 + escapedFileNameSizeBytes, "</u></p>", 9);
+
+    if (highlightLanguage != HighlightLanguageNone)
+    {
+        retval = HighlightText(pUtf8Buf, utf8SizeBytes, highlightLanguage,
+            pScratchArena, &pFormatInfo, &eb);
+        if (retval != 0)
+        {
+            snprintf(pJob->eb.errDescription,
+                sizeof(pJob->eb.errDescription),
+                "Highlighting file \"%s\" failed (%s)", pJob->pFileName,
+                eb.errDescription);
+            pJob->eb.errDescription[
+                sizeof(pJob->eb.errDescription) - 1] = '\0';
+            pJob->eb.functionSpecificErrorCode = 5;
+            return -1;
+        }
+    }
+
+    retval = GenerateHtmlFragment(pUtf8Buf, utf8SizeBytes, pFormatInfo,
+        yCrlf, preBlockSizeBytes, pHtmlPrefix, NULL, &pJob->arena,
+        &pJob->pHtmlFragment, &pJob->htmlFragmentSizeBytes, &eb);
+    pJob->styleClasses = GetFormatInfoStyleClasses(pFormatInfo,
+        preBlockSizeBytes);
+    if (retval != 0)
+    {
+        snprintf(pJob->eb.errDescription, sizeof(pJob->eb.errDescription),
+            "Generating HTML for file \"%s\" failed (%s)", pJob->pFileName,
+            eb.errDescription);
+        pJob->eb.errDescription[sizeof(pJob->eb.errDescription) - 1] = '\0';
+        pJob->eb.functionSpecificErrorCode = 7;
+        return -1;
+    }
+
+    retval = ConvToZeroTerminatedWideCharNewBuffer(pUtf8Buf, utf8SizeBytes,
+        CP_UTF8, yCrlf, &pJob->arena, &pJob->pWideCharBuf,
+        &pJob->wideCharBufSizeBytes, &eb);
+    if (retval == 0)
+    {
+        unsigned int headerSizeBytes;
+        retval = ConvToZeroTerminatedWideCharNewBuffer(pTextHeaderUtf8,
+            textHeaderSizeBytes, CP_UTF8, 0, &pJob->arena, &pJob->pTextHeader,
+            &headerSizeBytes, &eb);
+    }
+    if (retval != 0)
+    {
+        snprintf(pJob->eb.errDescription, sizeof(pJob->eb.errDescription),
+            "Generating text for file \"%s\" failed (%s)", pJob->pFileName,
+            eb.errDescription);
+        pJob->eb.errDescription[sizeof(pJob->eb.errDescription) - 1] = '\0';
+        pJob->eb.functionSpecificErrorCode = 8;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* InputFileWorkerThread()
+ *
+ * Thread function for multi-file mode: renders input files from a shared
+ * InputFileJobList until no unclaimed jobs are left. The temporary buffers
+ * of each file are released at once after it is rendered.
+ */
+DWORD WINAPI InputFileWorkerThread(LPVOID pParameter)
+{
+    InputFileJobList *pJobList = pParameter;
+    Arena scratchArena;
+
+    InitArena(&scratchArena);
+    while (1)
+    {
+        unsigned int jobIndex =
+            (unsigned int)InterlockedIncrement(&pJobList->nextJobIndex) - 1;
+        if (jobIndex >= pJobList->numberOfJobs)
+            break;
+        pJobList->pJobs[jobIndex].retval = RenderInputFile(
+            &pJobList->pJobs[jobIndex], &scratchArena, pJobList->codepage,
+            pJobList->yDetectCodepage, pJobList->bufferSizeStep,
+            pJobList->pLineSelection, pJobList->pLineFilter,
+            pJobList->highlightLanguage, pJobList->yCrlf,
+            pJobList->preBlockSizeBytes);
+        FreeArena(&scratchArena);
+    }
+
+    return 0;
+}
+
+/* FreeInputFileJobList()
+ *
+ * Release the arenas of all jobs with their results and the arena of the
+ * list with the job array and the output buffers.
+ */
+void FreeInputFileJobList(InputFileJobList *pJobList)
+{
+    unsigned int i;
+
+    for (i = 0; i < pJobList->numberOfJobs; i++)
+        FreeArena(&pJobList->pJobs[i].arena);
+    FreeArena(&pJobList->arena);
+}
+
+/* CopyInputFilesToClipboard()
+ *
+ * Read, convert and render several input files concurrently on a pool of
+ * worker threads (one per processor) and write the results concatenated in
+ * the given order as one CF_UNICODETEXT and one CF_HTML item to the
+ * clipboard. Each file is preceded by a header with its file name. When
+ * yDetectCodepage is set the codepage of each file is detected with
+ * DetectInputCodepage(), using the given codepage as the default. When the
+ * line selection pointer is not NULL only the selected lines of each file
+ * are read and when the line filter pointer is not NULL only the matching
+ * lines are kept. When yCrlf is set line feeds are converted to CR LF. The
+ * HTML text of each file is split into <pre> elements of the given block size
+ * (see InitPreTags()). The clipboard is written and the result is recorded in
+ * the clipboard history with the given options (NULL for the defaults, see
+ * AddClipboardHistoryEntry()).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int CopyInputFilesToClipboard(const char **ppFileNames,
+                              unsigned int numberOfFiles,
+                              unsigned int codepage,
+                              unsigned int yDetectCodepage,
+                              unsigned int bufferSizeStep,
+                              const LineSelection *pLineSelection,
+                              const LineFilter *pLineFilter,
+                              HighlightLanguage highlightLanguage,
+                              unsigned int yCrlf,
+                              unsigned int preBlockSizeBytes,
+                              const ClipboardOptions *pOptions,
+                              ErrBlock *pEb)
+{
+    HANDLE threadHandles[MAXIMUM_WAIT_OBJECTS];
+    SYSTEM_INFO systemInfo;
+    InputFileJobList jobList;
+    ClipboardData clipboardData[2];
+    ErrBlock eb;
+    const char **ppFragments = NULL;
+    unsigned int *pFragmentSizes = NULL;
+    unsigned int styleClasses = 0;
+    wchar_t *pTextBuffer = NULL;
+    char *pHtmlBuffer = NULL;
+    unsigned int htmlBufferSizeBytes;
+    unsigned int textCharacters = 0;
+    unsigned int textWriteIndex = 0;
+    unsigned int numberOfThreads;
+    unsigned int numberOfStartedThreads = 0;
+    unsigned int i;
+    int retval;
+
+    InitArena(&jobList.arena);
+    jobList.pJobs = ArenaAlloc(&jobList.arena,
+        numberOfFiles * sizeof(*jobList.pJobs));
+    if (jobList.pJobs == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate input file jobs");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+    memset(jobList.pJobs, 0, numberOfFiles * sizeof(*jobList.pJobs));
+    for (i = 0; i < numberOfFiles; i++)
+        jobList.pJobs[i].pFileName = ppFileNames[i];
+    jobList.numberOfJobs = numberOfFiles;
+    jobList.codepage = codepage;
+    jobList.yDetectCodepage = yDetectCodepage;
+    jobList.bufferSizeStep = bufferSizeStep;
+    jobList.pLineSelection = pLineSelection;
+    jobList.pLineFilter = pLineFilter;
+    jobList.highlightLanguage = highlightLanguage;
+    jobList.yCrlf = yCrlf;
+    jobList.preBlockSizeBytes = preBlockSizeBytes;
+    jobList.nextJobIndex = 0;
+
+    /* the calling thread is a worker too */
+    GetSystemInfo(&systemInfo);
+    numberOfThreads = systemInfo.dwNumberOfProcessors;
+    if (numberOfThreads > numberOfFiles)
+        numberOfThreads = numberOfFiles;
+    if (numberOfThreads > MAXIMUM_WAIT_OBJECTS + 1)
+        numberOfThreads = MAXIMUM_WAIT_OBJECTS + 1;
+    for (i = 1; i < numberOfThreads; i++)
+    {
+        threadHandles[numberOfStartedThreads] = CreateThread(NULL, 0,
+            InputFileWorkerThread, &jobList, 0, NULL);
+        if (threadHandles[numberOfStartedThreads] != NULL)
+            numberOfStartedThreads++;
+    }
+    InputFileWorkerThread(&jobList);
+    if (numberOfStartedThreads != 0)
+    {
+        WaitForMultipleObjects(numberOfStartedThreads, threadHandles, TRUE,
+            INFINITE);
+        for (i = 0; i < numberOfStartedThreads; i++)
+            CloseHandle(threadHandles[i]);
+    }
+
+    for (i = 0; i < numberOfFiles; i++)
+    {
+        if (jobList.pJobs[i].retval != 0)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "%s", jobList.pJobs[i].eb.errDescription);
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 2;
+            }
+            FreeInputFileJobList(&jobList);
+            return -1;
+        }
+    }
+
+    /* concatenate text: headers and file contents, separated by empty lines */
+    for (i = 0; i < numberOfFiles; i++)
+    {
+        textCharacters += (i != 0 ? 2 : 0) +
+            (unsigned int)wcslen(jobList.pJobs[i].pTextHeader) +
+            jobList.pJobs[i].wideCharBufSizeBytes / sizeof(wchar_t) - 1;
+    }
+    pTextBuffer = ArenaAlloc(&jobList.arena,
+        (textCharacters + 1) * sizeof(wchar_t));
+    ppFragments = ArenaAlloc(&jobList.arena,
+        numberOfFiles * sizeof(*ppFragments));
+    pFragmentSizes = ArenaAlloc(&jobList.arena,
+        numberOfFiles * sizeof(*pFragmentSizes));
+    if (pTextBuffer == NULL || ppFragments == NULL || pFragmentSizes == NULL)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Could not allocate output buffers");
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 3;
+        }
+        FreeInputFileJobList(&jobList);
+        return -1;
+    }
+    for (i = 0; i < numberOfFiles; i++)
+    {
+        unsigned int headerCharacters =
+            (unsigned int)wcslen(jobList.pJobs[i].pTextHeader);
+        unsigned int contentCharacters =
+            jobList.pJobs[i].wideCharBufSizeBytes / sizeof(wchar_t) - 1;
+
+        if (i != 0)
+        {
+            pTextBuffer[textWriteIndex++] = L'\r';
+            pTextBuffer[textWriteIndex++] = L'\n';
+        }
+        memcpy(pTextBuffer + textWriteIndex, jobList.pJobs[i].pTextHeader,
+            headerCharacters * sizeof(wchar_t));
+        textWriteIndex += headerCharacters;
+        memcpy(pTextBuffer + textWriteIndex, jobList.pJobs[i].pWideCharBuf,
+            contentCharacters * sizeof(wchar_t));
+        textWriteIndex += contentCharacters;
+
+        ppFragments[i] = jobList.pJobs[i].pHtmlFragment;
+        pFragmentSizes[i] = jobList.pJobs[i].htmlFragmentSizeBytes;
+        styleClasses |= jobList.pJobs[i].styleClasses;
+    }
+    pTextBuffer[textWriteIndex] = L'\0';
+
+    retval = GenerateClipboardHtmlFromFragments(ppFragments, pFragmentSizes,
+        numberOfFiles, styleClasses, &jobList.arena, &pHtmlBuffer,
+        &htmlBufferSizeBytes, &eb);
+    if (retval != 0)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Generating HTML failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 4;
+        }
+        FreeInputFileJobList(&jobList);
+        return -1;
+    }
+
+    clipboardData[0].format = CF_UNICODETEXT;
+    clipboardData[0].pData = pTextBuffer;
+    clipboardData[0].sizeBytes = (textCharacters + 1) * sizeof(wchar_t);
+    clipboardData[1].format = RegisterClipboardFormat("HTML Format");
+    clipboardData[1].pData = pHtmlBuffer;
+    clipboardData[1].sizeBytes = htmlBufferSizeBytes;
+    retval = WriteMultipleFormatsToClipboard(clipboardData, 2, pOptions,
+        &eb);
+    if (retval != 0)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Writing to the clipboard failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 5;
+        }
+        FreeInputFileJobList(&jobList);
+        return -1;
+    }
+
+    /* the clipboard is written, a failed history update is only counted in
+       the statistics */
+    AddClipboardHistoryEntry(clipboardData[0].pData, clipboardData[0].sizeBytes,
+        clipboardData[1].pData, clipboardData[1].sizeBytes, pOptions, NULL);
+
+    FreeInputFileJobList(&jobList);
+    return 0;
+}
+
+/* CreateRenderContext()
+ *
+ * Allocate an empty RenderContext structure, which must be released with
+ * FreeRenderContext().
+ *
+ * Returns the address of the structure or NULL if it could not be allocated.
+ */
+RenderContext *CreateRenderContext(void)
+{
+    RenderContext *pContext = AllocMemory(sizeof(RenderContext));
+
+    if (pContext != NULL)
+    {
+        memset(pContext, 0, sizeof(RenderContext));
+        InitArena(&pContext->arena);
+        pContext->formatInfo.pArena = &pContext->arena;
+    }
+    return pContext;
+}
+
+/* FreeRenderContext()
+ *
+ * Release a RenderContext structure created with CreateRenderContext() and
+ * its retained buffers (may be NULL).
+ */
+void FreeRenderContext(RenderContext *pContext)
+{
+    if (pContext == NULL)
+        return;
+    FreeArena(&pContext->arena);
+    FreeMemory(pContext);
+}
+
+/* PrepareUtf8Text()
+ *
+ * Set the UTF8 text of a context whose wide character text is already set,
+ * from the same input as the wide character text, and fill the FormatInfo
+ * structure of the context with the highlighting tags of the UTF8 text.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int PrepareUtf8Text(RenderContext *pContext, const char *pInputBuffer,
+                    unsigned int numberOfInputBytes, unsigned int codepage,
+                    HighlightLanguage highlightLanguage, ErrBlock *pEb)
+{
+    const wchar_t *pDecodeTable;
+    int retval;
+    ErrBlock eb;
+
+    /* UTF8 text: the input itself, encoded with a built-in table or
+       converted from the wide character string */
+    pDecodeTable = GetSingleByteDecodeTable(codepage);
+    if (codepage == CP_UTF8)
+    {
+        pContext->pUtf8Text = pInputBuffer;
+        pContext->utf8TextSizeBytes = numberOfInputBytes;
+    }
+    else
+    {
+        unsigned int numberOfWideCharacters =
+            pContext->wideCharTextSizeBytes / sizeof(wchar_t) - 1;
+        unsigned int utf8SizeBytes;
+
+        if (pDecodeTable != NULL)
+        {
+            utf8SizeBytes = EncodeSingleByteStringAsUtf8(
+                (const unsigned char *)pInputBuffer, numberOfInputBytes,
+                pDecodeTable, NULL);
+        }
+        else if (numberOfWideCharacters != 0)
+        {
+            utf8SizeBytes = WideCharToMultiByte(CP_UTF8, 0,
+                pContext->pWideCharText, numberOfWideCharacters, NULL, 0,
+                NULL, NULL);
+            if (utf8SizeBytes == 0)
+            {
+                if (pEb != NULL)
+                {
+                    snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                        "WideCharToMultiByte() space detection failed, "
+                        "GetLastError() = 0x%X", GetLastError());
+                    pEb->errDescription[sizeof(pEb->errDescription) - 1] =
+                        '\0';
+                    pEb->functionSpecificErrorCode = 2;
+                }
+                return -1;
+            }
+        }
+        else
+        {
+            utf8SizeBytes = 0;
+        }
+
+        if (ReserveBuffer(&pContext->arena, (void **)&pContext->pUtf8Buf,
+            &pContext->utf8BufCapacityBytes, utf8SizeBytes, pEb))
+        {
+            return -1;
+        }
+
+        if (pDecodeTable != NULL)
+        {
+            EncodeSingleByteStringAsUtf8((const unsigned char *)pInputBuffer,
+                numberOfInputBytes, pDecodeTable, pContext->pUtf8Buf);
+        }
+        else if (utf8SizeBytes != 0 &&
+            WideCharToMultiByte(CP_UTF8, 0, pContext->pWideCharText,
+                numberOfWideCharacters, pContext->pUtf8Buf, utf8SizeBytes,
+                NULL, NULL) == 0)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "WideCharToMultiByte() conversion failed, "
+                    "GetLastError() = 0x%X", GetLastError());
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 2;
+            }
+            return -1;
+        }
+        pContext->pUtf8Text = pContext->pUtf8Buf;
+        pContext->utf8TextSizeBytes = utf8SizeBytes;
+    }
+
+    // TODO create format info from ANSI escape sequences
+    ClearFormatInfo(&pContext->formatInfo);
+    if (highlightLanguage != HighlightLanguageNone)
+    {
+        retval = AppendHighlightTags(pContext->pUtf8Text,
+            pContext->utf8TextSizeBytes, highlightLanguage,
+            &pContext->formatInfo, &eb);
+        if (retval != 0)
+        {
+            if (pEb != NULL)
+            {
+                snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                    "Highlighting failed (%s)", eb.errDescription);
+                pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+                pEb->functionSpecificErrorCode = 3;
+            }
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* RenderDecodedText()
+ *
+ * Render the UTF8 text and the CF_HTML data of a context whose wide character
+ * text is already set, from the same input as the wide character text (see
+ * RenderText()).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int RenderDecodedText(RenderContext *pContext, const char *pInputBuffer,
+                      unsigned int numberOfInputBytes, unsigned int codepage,
+                      HighlightLanguage highlightLanguage, unsigned int yCrlf,
+                      ErrBlock *pEb)
+{
+    unsigned int styleClasses;
+    unsigned int htmlStartSizeBytes;
+    int retval;
+    ErrBlock eb;
+
+    if (PrepareUtf8Text(pContext, pInputBuffer, numberOfInputBytes, codepage,
+        highlightLanguage, pEb))
+    {
+        return -1;
+    }
+
+    /* CF_HTML data: generated start (with the used CSS classes), fragment
+       and end, then the offsets in the description */
+    styleClasses = GetFormatInfoStyleClasses(&pContext->formatInfo,
+        pContext->preBlockSizeBytes);
+    htmlStartSizeBytes = GenerateClipboardHtmlStart(styleClasses, NULL);
+    if (ReserveBuffer(&pContext->arena, (void **)&pContext->pHtmlStartBuf,
+        &pContext->htmlStartBufCapacityBytes, htmlStartSizeBytes + 1, pEb))
+    {
+        return -1;
+    }
+    GenerateClipboardHtmlStart(styleClasses, pContext->pHtmlStartBuf);
+    pContext->pHtmlStartBuf[htmlStartSizeBytes] = '\0';
+
+    retval = GenerateHtmlFragmentInBuffer(pContext->pUtf8Text,
+        pContext->utf8TextSizeBytes, &pContext->formatInfo, yCrlf,
+        pContext->preBlockSizeBytes, pContext->pHtmlStartBuf,
+        clipboardHtmlEndString, &pContext->arena, &pContext->pHtmlBuf,
+        &pContext->htmlBufCapacityBytes, &pContext->htmlBufSizeBytes, &eb);
+    if (retval != 0)
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Generating HTML failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 4;
+        }
+        return -1;
+    }
+    FillClipboardHtmlDescription(pContext->pHtmlBuf,
+        pContext->htmlBufSizeBytes, htmlStartSizeBytes);
+
+    return 0;
+}
+
+/* DecodeText()
+ *
+ * Convert a given string (not zero terminated) in a given codepage to the
+ * wide character text of a context, stored in its retained buffer (see
+ * ConvToZeroTerminatedWideCharBuffer()).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int DecodeText(RenderContext *pContext, const char *pInputBuffer,
+               unsigned int numberOfInputBytes, unsigned int codepage,
+               unsigned int yCrlf, ErrBlock *pEb)
+{
+    ErrBlock eb;
+
+    if (ConvToZeroTerminatedWideCharBuffer(pInputBuffer, numberOfInputBytes,
+        codepage, yCrlf, &pContext->arena, &pContext->pWideCharBuf,
+        &pContext->wideCharBufCapacityBytes, &pContext->wideCharTextSizeBytes,
+        &eb))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Conversion to wide characters failed (%s)",
+                eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+    pContext->pWideCharText = pContext->pWideCharBuf;
+
+    return 0;
+}
+
+/* DecodeTextInPlace()
+ *
+ * Set the wide character text of a context like DecodeText(), but use
+ * UTF16LE input (without line feed conversion) in place instead of copying
+ * it to the retained buffer: a zero termination character is written behind
+ * the last complete character (over an odd last byte), so the buffer must
+ * have sizeof(wchar_t) spare bytes behind the input (like the buffers of
+ * ReadFileToNewBuffer() and ReadFileLinesToNewBuffer()) and must stay valid
+ * and unchanged as long as the text is used. Other input and input that is
+ * not aligned for wide characters is decoded with DecodeText().
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int DecodeTextInPlace(RenderContext *pContext, char *pInputBuffer,
+                      unsigned int numberOfInputBytes, unsigned int codepage,
+                      unsigned int yCrlf, ErrBlock *pEb)
+{
+    unsigned int numberOfWideCharacters;
+
+    if (codepage != CODEPAGE_UTF16LE || yCrlf ||
+        ((size_t)pInputBuffer % sizeof(wchar_t)) != 0)
+    {
+        return DecodeText(pContext, pInputBuffer, numberOfInputBytes,
+            codepage, yCrlf, pEb);
+    }
+
+    numberOfWideCharacters = numberOfInputBytes / sizeof(wchar_t);
+    ((wchar_t *)pInputBuffer)[numberOfWideCharacters] = L'\0';
+    pContext->pWideCharText = (const wchar_t *)pInputBuffer;
+    pContext->wideCharTextSizeBytes =
+        (numberOfWideCharacters + 1) * sizeof(wchar_t);
+
+    return 0;
+}
+
+/* RenderText()
+ *
+ * Render a given string (not zero terminated) in a given codepage to the
+ * clipboard formats: a zero terminated wide character string for
+ * CF_UNICODETEXT and CF_HTML data with optional syntax highlighting. When
+ * yCrlf is set line feeds are converted to CR LF in both formats while
+ * decoding and escaping (the UTF8 text and its tag positions are unchanged).
+ * The results are stored in the retained buffers of the context and stay
+ * valid until the next call. UTF8 input is used in place, without a copy.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int RenderText(RenderContext *pContext, const char *pInputBuffer,
+               unsigned int numberOfInputBytes, unsigned int codepage,
+               HighlightLanguage highlightLanguage, unsigned int yCrlf,
+               ErrBlock *pEb)
+{
+    if (DecodeText(pContext, pInputBuffer, numberOfInputBytes, codepage,
+        yCrlf, pEb))
+    {
+        return -1;
+    }
+
+    return RenderDecodedText(pContext, pInputBuffer, numberOfInputBytes,
+        codepage, highlightLanguage, yCrlf, pEb);
+}
+
+/* RenderTextInPlace()
+ *
+ * Render a given string like RenderText(), but use UTF16LE input in place as
+ * the CF_UNICODETEXT data (see DecodeTextInPlace() for the requirements of
+ * the input buffer).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int RenderTextInPlace(RenderContext *pContext, char *pInputBuffer,
+                      unsigned int numberOfInputBytes, unsigned int codepage,
+                      HighlightLanguage highlightLanguage, unsigned int yCrlf,
+                      ErrBlock *pEb)
+{
+    if (DecodeTextInPlace(pContext, pInputBuffer, numberOfInputBytes,
+        codepage, yCrlf, pEb))
+    {
+        return -1;
+    }
+
+    return RenderDecodedText(pContext, pInputBuffer, numberOfInputBytes,
+        codepage, highlightLanguage, yCrlf, pEb);
+}
+
+/* EmitText()
+ *
+ * Render a given string like RenderTextInPlace() and write the clipboard
+ * formats to files instead of the clipboard: the CF_UNICODETEXT data (with
+ * its zero termination character) to the text file handle and the CF_HTML
+ * data to the HTML file handle (see WriteClipboardHtmlToFile(), the HTML is
+ * not stored in the context). A file handle of INVALID_HANDLE_VALUE skips
+ * its format.
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int EmitText(RenderContext *pContext, char *pInputBuffer,
+             unsigned int numberOfInputBytes, unsigned int codepage,
+             HighlightLanguage highlightLanguage, unsigned int yCrlf,
+             HANDLE textFileHandle, HANDLE htmlFileHandle, ErrBlock *pEb)
+{
+    ErrBlock eb;
+
+    /* the UTF8 text of UTF8 input and of codepages with a built-in table
+       does not need the wide character text */
+    if ((textFileHandle != INVALID_HANDLE_VALUE ||
+        (codepage != CP_UTF8 && GetSingleByteDecodeTable(codepage) == NULL))
+        && DecodeTextInPlace(pContext, pInputBuffer, numberOfInputBytes,
+        codepage, yCrlf, pEb))
+    {
+        return -1;
+    }
+
+    if (textFileHandle != INVALID_HANDLE_VALUE &&
+        WriteAllToFile(textFileHandle, pContext->pWideCharText,
+        pContext->wideCharTextSizeBytes, &eb))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Writing the text failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 1;
+        }
+        return -1;
+    }
+
+    if (htmlFileHandle == INVALID_HANDLE_VALUE)
+        return 0;
+
+    if (PrepareUtf8Text(pContext, pInputBuffer, numberOfInputBytes, codepage,
+        highlightLanguage, pEb))
+    {
+        return -1;
+    }
+    if (WriteClipboardHtmlToFile(htmlFileHandle, pContext->pUtf8Text,
+        pContext->utf8TextSizeBytes, &pContext->formatInfo, yCrlf,
+        pContext->preBlockSizeBytes, &eb))
+    {
+        if (pEb != NULL)
+        {
+            snprintf(pEb->errDescription, sizeof(pEb->errDescription),
+                "Writing the HTML failed (%s)", eb.errDescription);
+            pEb->errDescription[sizeof(pEb->errDescription) - 1] = '\0';
+            pEb->functionSpecificErrorCode = 2;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/* PublishRenderedText()
+ *
+ * Write the results of the last RenderText() call of a context to the
+ * clipboard, both formats at once, and record them in the clipboard history
+ * (see AddClipboardHistoryEntry()), with the given options (NULL for the
+ * defaults, see InitClipboardOptions()).
+ *
+ * Returns zero on success or -1 in case of an error. In case of an error
+ * and when the error block pointer is not NULL the error block is filled with
+ * an error description.
+ */
+int PublishRenderedText(const RenderContext *pContext,
+                        const ClipboardOptions *pOptions, ErrBlock *pEb)
+{
+    ClipboardData clipboardData[2];
+
+    clipboardData[0].format = CF_UNICODETEXT;
+    clipboardData[0].pData = pContext->pWideCharText;
+    clipboardData[0].sizeBytes = pContext->wideCharTextSizeBytes;
+    clipboardData[1].format = RegisterClipboardFormat("HTML Format");
+    clipboardData[1].pData = pContext->pHtmlBuf;
+    clipboardData[1].sizeBytes = pContext->htmlBufSizeBytes;
+
+    if (WriteMultipleFormatsToClipboard(clipboardData, 2, pOptions, pEb))
+        return -1;
+
+    /* the clipboard is written, a failed history update is only counted in
+       the statistics */
+    AddClipboardHistoryEntry(clipboardData[0].pData, clipboardData[0].sizeBytes,
+        clipboardData[1].pData, clipboardData[1].sizeBytes, pOptions, NULL);
+    return 0;
+}
+
@@ -0,0 +1,434 @@
+/* libcclip
+ * Rendering functions of cclip for use in other programs
+ * Copyright (c) 2013 Alexander F. Mayer
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCCLIP_H
+#define LIBCCLIP_H
+
+#include <windows.h>
+
+/* codepage identifiers of UTF16 (not supported by MultiByteToWideChar())
+   and the number of input bytes examined by DetectInputCodepage() */
+#define CODEPAGE_UTF16LE            1200
+#define CODEPAGE_UTF16BE            1201
+#define CODEPAGE_DETECTION_BYTES    65536
+
+typedef struct ErrBlock_
+{
+    unsigned int functionSpecificErrorCode;
+    char errDescription[256];
+} ErrBlock;
+
+/* stages of a run in which allocations are counted separately, see
+   SetAllocationStage() */
+#define NUMBER_OF_ALLOCATION_STAGES 5
+
+typedef enum AllocationStage_
+{
+    AllocationStageSetup,
+    AllocationStageRead,
+    AllocationStageFilter,
+    AllocationStageRender,
+    AllocationStageClipboard
+} AllocationStage;
+
+/* allocations of a stage and the peak of all allocated bytes (including
+   those of previous stages) while the stage was active */
+typedef struct AllocationStats_
+{
+    unsigned int numberOfAllocations;
+    unsigned int numberOfReallocations;
+    unsigned int numberOfFrees;
+    size_t peakBytes;
+} AllocationStats;
+
+/* block of an arena, followed by its data */
+typedef struct ArenaBlock_
+{
+    struct ArenaBlock_ *pNext;
+    size_t sizeBytes;
+    size_t usedBytes;
+    size_t yOwnBlock;   /* one large allocation, keeps the data aligned */
+} ArenaBlock;
+
+/* memory for buffers with a common lifetime, released all at once with
+   FreeArena() instead of one by one (see ArenaAlloc()) */
+typedef struct Arena_
+{
+    ArenaBlock *pBlocks;
+} Arena;
+
+typedef enum TagType_
+{
+    TagTypePreWithAttributes,
+    TagTypeUnderscore,
+    TagTypeFgBlue,
+    TagTypeFgGreen,
+    TagTypeFgRed,
+    TagTypeBgBlue,
+    TagTypeBgGreen,
+    TagTypeBgRed,
+    TagTypeBold,
+    TagTypeFgMagenta,
+    TagTypeFgYellow,
+    TagTypeFgGray,
+    TagTypePreBlock
+    // TODO extend TagType enum values
+} TagType;
+
+/* a single formatting tag: a TagType with a parameter, either opening or
+   closing, applied at a byte position of the UTF8 text */
+typedef struct FormatInfoTag_
+{
+    unsigned int bytePos;
+    TagType type;
+    unsigned int parameter;
+    unsigned int yClose;
+} FormatInfoTag;
+
+/* FormatInfo stores tags compactly as a structure of arrays: the positions
+   as variable length deltas to the previous tag and everything else packed
+   into one word per tag. Tags are sorted by ascending position, tags at the
+   same position are applied in the order they were appended. */
+#define FORMATINFO_TYPE_MASK        0xFFu
+#define FORMATINFO_CLOSE_FLAG       0x100u
+#define FORMATINFO_PARAMETER_SHIFT  9
+#define FORMATINFO_PARAMETER_BITS   23
+
+typedef struct FormatInfo_
+{
+    unsigned int numberOfTags;
+    unsigned int tagWordCapacity;
+    unsigned int *pTagWords;
+    unsigned char *pPositionDeltas;
+    unsigned int positionDeltaBytes;
+    unsigned int positionDeltaCapacity;
+    unsigned int lastBytePos;
+    Arena *pArena;                  /* the tag arrays grow in this arena */
+} FormatInfo;
+
+/* walks the tags of a FormatInfo structure, see InitFormatInfoIterator() */
+typedef struct FormatInfoIterator_
+{
+    const FormatInfo *pFormatInfo;
+    const FormatInfoTag *pHeadTags;
+    unsigned int numberOfHeadTags;
+    const FormatInfoTag *pTailTags;
+    unsigned int numberOfTailTags;
+    unsigned int tagIndex;
+    unsigned int positionDeltaReadIndex;
+    unsigned int bytePos;
+} FormatInfoIterator;
+
+typedef enum HighlightLanguage_
+{
+    HighlightLanguageNone,
+    HighlightLanguageDiff,
+    HighlightLanguageC,
+    HighlightLanguageLog
+} HighlightLanguage;
+
+/* lines to read from the input: lines firstLine to lastLine (counted from 1,
+   lastLine 0 for all following lines) or the last numberOfTailLines lines */
+typedef struct LineSelection_
+{
+    unsigned int yTail;
+    unsigned int firstLine;
+    unsigned int lastLine;
+    unsigned int numberOfTailLines;
+} LineSelection;
+
+/* lines to keep from the input: lines matching the regular expression
+   pPattern (in the ANSI codepage) with contextLines lines before and after;
+   ".", bracket expressions and escapes match one character, which is one
+   UTF8 sequence for UTF8 input and one byte for all other codepages */
+typedef struct LineFilter_
+{
+    const char *pPattern;
+    unsigned int contextLines;
+} LineFilter;
+
+/* retained buffers (see ReserveBuffer()) reused by every RenderText() call,
+   so that rendering inputs of similar size stops allocating after warm-up,
+   the results of the last call (the texts point into the retained buffers
+   or into the input), the maximum size of the <pre> blocks of the HTML
+   code (0 for one <pre> element, see InitPreTags()) and the arena that
+   holds the retained buffers until FreeRenderContext() */
+typedef struct RenderContext_
+{
+    wchar_t *pWideCharBuf;
+    unsigned int wideCharBufCapacityBytes;
+    const wchar_t *pWideCharText;
+    unsigned int wideCharTextSizeBytes;
+    char *pUtf8Buf;
+    unsigned int utf8BufCapacityBytes;
+    const char *pUtf8Text;
+    unsigned int utf8TextSizeBytes;
+    FormatInfo formatInfo;
+    char *pHtmlStartBuf;
+    unsigned int htmlStartBufCapacityBytes;
+    char *pHtmlBuf;
+    unsigned int htmlBufCapacityBytes;
+    unsigned int htmlBufSizeBytes;
+    unsigned int preBlockSizeBytes;
+    Arena arena;
+} RenderContext;
+
+typedef struct ClipboardData_
+{
+    unsigned int format;
+    const void *pData;
+    unsigned int sizeBytes;
+} ClipboardData;
+
+/* time-to-acquire histogram buckets of the clipboard: below 1 ms, 1-2 ms,
+   2-4 ms, ... and the last bucket for everything from 512 ms on */
+#define CLIPBOARD_ACQUIRE_HISTOGRAM_BUCKETS 11
+
+/* statistics of all OpenClipboard() calls of this process, see
+   AcquireClipboard() */
+typedef struct ClipboardAcquisitionStats_
+{
+    unsigned int numberOfAcquisitions;
+    unsigned int numberOfFailures;
+    unsigned int numberOfRetries;
+    double maxAcquireTimeMs;
+    unsigned int histogram[CLIPBOARD_ACQUIRE_HISTOGRAM_BUCKETS];
+} ClipboardAcquisitionStats;
+
+/* settings of the functions that open the clipboard or the clipboard
+   history, passed with each call (see InitClipboardOptions()) */
+typedef struct ClipboardOptions_
+{
+    unsigned int timeoutMs;
+    unsigned int yHistory;
+} ClipboardOptions;
+
+/* memory with allocation statistics */
+void *AllocMemory(size_t sizeBytes);
+void *ReallocMemory(void *pMemory, size_t sizeBytes);
+void FreeMemory(void *pMemory);
+void SetAllocationStage(AllocationStage stage);
+void GetAllocationStats(AllocationStage stage, AllocationStats *pStats);
+void InitArena(Arena *pArena);
+void *ArenaAlloc(Arena *pArena, size_t sizeBytes);
+void *ArenaRealloc(Arena *pArena, void *pMemory, size_t oldSizeBytes,
+                   size_t sizeBytes);
+void FreeArena(Arena *pArena);
+
+/* reading input and converting between codepages */
+int ReadFileToNewBuffer(HANDLE fileHandle, unsigned int bufferSizeStep,
+                        Arena *pArena, void **ppAllocatedBuffer,
+                        unsigned int *pReadBytes, ErrBlock *pEb);
+int ReadFileLinesToNewBuffer(HANDLE fileHandle, unsigned int bufferSizeStep,
+                             const LineSelection *pLineSelection,
+                             Arena *pArena, void **ppAllocatedBuffer,
+                             unsigned int *pSelectionSizeBytes,
+                             ErrBlock *pEb);
+int FilterLinesToNewBuffer(const char *pInputBuffer,
+                           unsigned int numberOfInputBytes,
+                           unsigned int codepage,
+                           const LineFilter *pLineFilter, Arena *pArena,
+                           char **ppAllocatedBuffer,
+                           unsigned int *pFilteredSizeBytes, ErrBlock *pEb);
+const wchar_t *GetSingleByteDecodeTable(unsigned int codepage);
+unsigned int DetectInputCodepage(const char *pInputBuffer,
+                                 unsigned int numberOfInputBytes,
+                                 unsigned int defaultCodepage,
+                                 unsigned int *pBomSizeBytes);
+void DecodeSingleByteString(const unsigned char *pInput,
+                            unsigned int numberOfInputBytes,
+                            const wchar_t *pDecodeTable,
+                            wchar_t *pOutput);
+int ReserveBuffer(Arena *pArena, void **ppBuffer,
+                  unsigned int *pBufferCapacityBytes, unsigned int sizeBytes,
+                  ErrBlock *pEb);
+int ConvToZeroTerminatedWideCharBuffer(const char *pInputBuffer,
+                                       unsigned int numberOfInputBytes,
+                                       unsigned int codepage,
+                                       unsigned int yCrlf, Arena *pArena,
+                                       wchar_t **ppWideCharBuffer,
+                                       unsigned int *pBufferCapacityBytes,
+                                       unsigned int *pWideCharSizeBytes,
+                                       ErrBlock *pEb);
+int ConvToZeroTerminatedWideCharNewBuffer(const char *pInputBuffer,
+                                          unsigned int numberOfInputBytes,
+                                          unsigned int codepage,
+                                          unsigned int yCrlf, Arena *pArena,
+                                          wchar_t **ppAllocatedWideCharBuffer,
+                                          unsigned int *pAllocatedBufSizeBytes,
+                                          ErrBlock *pEb);
+unsigned int EncodeSingleByteStringAsUtf8(const unsigned char *pInput,
+                                          unsigned int numberOfInputBytes,
+                                          const wchar_t *pDecodeTable,
+                                          char *pOutput);
+int ConvToUtf8NewBuffer(const char *pInputBuffer,
+                        unsigned int numberOfInputBytes,
+                        unsigned int codepage, Arena *pArena,
+                        char **ppAllocatedUtf8Buffer,
+                        unsigned int *pUtf8SizeBytes,
+                        ErrBlock *pEb);
+
+/* clipboard access and output files */
+void InitClipboardOptions(ClipboardOptions *pOptions);
+int AcquireClipboard(unsigned int timeoutMs, ErrBlock *pEb);
+void GetClipboardAcquisitionStats(ClipboardAcquisitionStats *pStats);
+void PrintStats(void);
+int WriteMultipleFormatsToClipboard(const ClipboardData *pClipboardData,
+                                    unsigned int numberOfFormats,
+                                    const ClipboardOptions *pOptions,
+                                    ErrBlock *pEb);
+int WriteToClipboard(unsigned int format, const void *pData,
+                     unsigned int sizeBytes, const ClipboardOptions *pOptions,
+                     ErrBlock *pEb);
+int WriteAllToFile(HANDLE fileHandle, const void *pData, unsigned int sizeBytes,
+                   ErrBlock *pEb);
+int WriteWideCharsToFile(HANDLE fileHandle, const wchar_t *pWideChars,
+                         unsigned int numberOfWideChars, unsigned int codepage,
+                         ErrBlock *pEb);
+int WriteUtf8ToFile(HANDLE fileHandle, const char *pUtf8,
+                    unsigned int utf8SizeBytes, unsigned int codepage,
+                    ErrBlock *pEb);
+int ReadClipboardToFile(HANDLE fileHandle, unsigned int yHtml,
+                        unsigned int codepage,
+                        const ClipboardOptions *pOptions, ErrBlock *pEb);
+
+/* clipboard history */
+int AddClipboardHistoryEntry(const void *pText, unsigned int textSizeBytes,
+                             const void *pHtml, unsigned int htmlSizeBytes,
+                             const ClipboardOptions *pOptions, ErrBlock *pEb);
+int RecallClipboardHistoryEntry(unsigned int entryNumber,
+                                const ClipboardOptions *pOptions,
+                                ErrBlock *pEb);
+
+/* FormatInfo structures */
+FormatInfo *CreateFormatInfo(Arena *pArena);
+void ClearFormatInfo(FormatInfo *pFormatInfo);
+int AppendFormatInfoTag(FormatInfo *pFormatInfo, unsigned int bytePos,
+                        TagType type, unsigned int parameter,
+                        unsigned int yClose);
+void InitFormatInfoIterator(FormatInfoIterator *pIterator,
+                            const FormatInfo *pFormatInfo,
+                            const FormatInfoTag *pHeadTags,
+                            unsigned int numberOfHeadTags,
+                            const FormatInfoTag *pTailTags,
+                            unsigned int numberOfTailTags);
+int NextFormatInfoTag(FormatInfoIterator *pIterator, FormatInfoTag *pTag);
+
+/* HTML generation */
+int GenerateHtmlMarkupFromFormatInfoTag(TagType type, unsigned parameter,
+                                        unsigned int yClose,
+                                        char *pOutputBuffer,
+                                        unsigned int bufferSizeBytes);
+unsigned int EscapeHtmlText(const char *pInput, unsigned int inputSizeBytes,
+                            const char *pCrlfTextStart, char *pOutput);
+unsigned int GetFormatInfoStyleClasses(const FormatInfo *pFormatInfo,
+                                       unsigned int preBlockSizeBytes);
+unsigned int GenerateClipboardHtmlStart(unsigned int styleClasses,
+                                        char *pOutput);
+void FillClipboardHtmlDescription(char *pHtmlBuffer,
+                                  unsigned int htmlSizeBytes,
+                                  unsigned int startFragment);
+int GenerateHtmlFragmentInBuffer(const char *pInputBuffer,
+                                 unsigned int inputBufSizeBytes,
+                                 const FormatInfo *pFormatInfo,
+                                 unsigned int yCrlf,
+                                 unsigned int preBlockSizeBytes,
+                                 const char *pPrefixString,
+                                 const char *pSuffixString,
+                                 Arena *pArena, char **ppHtmlBuffer,
+                                 unsigned int *pHtmlBufCapacityBytes,
+                                 unsigned int *pHtmlSizeBytes,
+                                 ErrBlock *pEb);
+int GenerateHtmlFragment(const char *pInputBuffer,
+                         unsigned int inputBufSizeBytes,
+                         const FormatInfo *pFormatInfo,
+                         unsigned int yCrlf,
+                         unsigned int preBlockSizeBytes,
+                         const char *pPrefixString,
+                         const char *pSuffixString, Arena *pArena,
+                         char **ppAllocatedHtmlBuffer,
+                         unsigned int *pAllocatedHtmlBufSizeBytes,
+                         ErrBlock *pEb);
+int GenerateClipboardHtml(const char *pInputBuffer,
+                          unsigned int inputBufSizeBytes,
+                          const FormatInfo *pFormatInfo,
+                          unsigned int yCrlf,
+                          unsigned int preBlockSizeBytes, Arena *pArena,
+                          char **ppAllocatedHtmlBuffer,
+                          unsigned int *pAllocatedHtmlBufSizeBytes,
+                          ErrBlock *pEb);
+int GenerateClipboardHtmlFromFragments(const char **ppFragments,
+                                       const unsigned int *pFragmentSizes,
+                                       unsigned int numberOfFragments,
+                                       unsigned int styleClasses,
+                                       Arena *pArena,
+                                       char **ppAllocatedHtmlBuffer,
+                                       unsigned int *pAllocatedHtmlBufSizeBytes,
+                                       ErrBlock *pEb);
+int WriteClipboardHtmlToFile(HANDLE fileHandle, const char *pInputBuffer,
+                             unsigned int inputBufSizeBytes,
+                             const FormatInfo *pFormatInfo,
+                             unsigned int yCrlf,
+                             unsigned int preBlockSizeBytes, ErrBlock *pEb);
+
+/* formatting from ANSI escape sequences and syntax highlighting */
+int ExtractFormatInfoFromAnsiEscape(const char *pInputBuffer,
+                                    unsigned int inputBufSizeBytes,
+                                    FormatInfo **ppAllocatedFormatInfo,
+                                    char **ppAllocatedUtf8Buffer,
+                                    unsigned int *pAllocatedBufSizeBytes,
+                                    ErrBlock *pEb);
+int AppendHighlightTags(const char *pInputBuffer,
+                        unsigned int inputBufSizeBytes,
+                        HighlightLanguage language, FormatInfo *pFormatInfo,
+                        ErrBlock *pEb);
+int HighlightText(const char *pInputBuffer, unsigned int inputBufSizeBytes,
+                  HighlightLanguage language, Arena *pArena,
+                  FormatInfo **ppAllocatedFormatInfo, ErrBlock *pEb);
+
+/* rendering input files and texts to the clipboard formats */
+int CopyInputFilesToClipboard(const char **ppFileNames,
+                              unsigned int numberOfFiles,
+                              unsigned int codepage,
+                              unsigned int yDetectCodepage,
+                              unsigned int bufferSizeStep,
+                              const LineSelection *pLineSelection,
+                              const LineFilter *pLineFilter,
+                              HighlightLanguage highlightLanguage,
+                              unsigned int yCrlf,
+                              unsigned int preBlockSizeBytes,
+                              const ClipboardOptions *pOptions,
+                              ErrBlock *pEb);
+RenderContext *CreateRenderContext(void);
+void FreeRenderContext(RenderContext *pContext);
+int RenderText(RenderContext *pContext, const char *pInputBuffer,
+               unsigned int numberOfInputBytes, unsigned int codepage,
+               HighlightLanguage highlightLanguage, unsigned int yCrlf,
+               ErrBlock *pEb);
+int RenderTextInPlace(RenderContext *pContext, char *pInputBuffer,
+                      unsigned int numberOfInputBytes, unsigned int codepage,
+                      HighlightLanguage highlightLanguage, unsigned int yCrlf,
+                      ErrBlock *pEb);
+int PublishRenderedText(const RenderContext *pContext,
+                        const ClipboardOptions *pOptions, ErrBlock *pEb);
+int EmitText(RenderContext *pContext, char *pInputBuffer,
+             unsigned int numberOfInputBytes, unsigned int codepage,
+             HighlightLanguage highlightLanguage, unsigned int yCrlf,
+             HANDLE textFileHandle, HANDLE htmlFileHandle, ErrBlock *pEb);
+
+#endif /* #ifndef LIBCCLIP_H */